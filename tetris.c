@@ -17,14 +17,410 @@
 #include <termios.h> // since I am on macOS I need this for terminal controlling
 #include <fcntl.h>  
 #include <errno.h>
+#include <stdint.h> // fixed width ints for the bitboard rows
+#include <string.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <pthread.h> // the headless game farm runs on several threads
+#include <stdatomic.h>
+#include <sys/mman.h> // replay corpora are mapped instead of read
+#include <sys/stat.h>
+#include <sys/uio.h> // readv for the keys
+#include <signal.h>
+#include <sys/socket.h> // the server mode
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h> // the spectator client looks the server up
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/event.h> // kqueue on macOS and the BSDs
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // AVX2 for the batch collision test, rdtsc for the benchmarks
+#endif
 
 
 
 // here I define some macros that I will be using in the game
+// the board size is picked when compiling, e.g. -DBOARD_WIDTH=10 -DBOARD_HEIGHT=40 -DBOARD_HIDDEN_ROWS=20 for the
+// usual 10 wide board with 20 rows above the visible ones where the pieces come in, every size is its own build
+#ifndef BOARD_WIDTH
 #define BOARD_WIDTH 20
-#define BOARD_HEIGHT 20
+#endif
+#ifndef BOARD_HEIGHT
+#define BOARD_HEIGHT 20 // all the rows, the hidden ones too
+#endif
+#ifndef BOARD_HIDDEN_ROWS
+#define BOARD_HIDDEN_ROWS 0 // rows at the top that are part of the board but not drawn
+#endif
+#define BOARD_VISIBLE_ROWS (BOARD_HEIGHT - BOARD_HIDDEN_ROWS)
 #define EMPTY_CELL ' '
 #define FILLED_CELL '#'
+#define GHOST_CELL '.' // shows where the falling piece would land
+
+// the board is stored as a bitboard, every row is one word and bit x is the column x
+// so a full row is simply all of the low BOARD_WIDTH bits set
+// the word is as small as the width allows, a 10 wide board has 16 bit rows and the whole board is half the size
+#if BOARD_WIDTH <= 16
+typedef uint16_t board_row_t;
+#define BOARD_ROW_BITS 16
+#else
+typedef uint32_t board_row_t;
+#define BOARD_ROW_BITS 32
+#endif
+#define FULL_ROW_MASK ((board_row_t)((1ull << BOARD_WIDTH) - 1))
+#define CELL_BIT(x) ((board_row_t)1 << (x))
+
+_Static_assert(BOARD_WIDTH >= 4 && BOARD_WIDTH <= 32, "a board row has to fit into board_row_t (and an I piece into a row)");
+_Static_assert(BOARD_HIDDEN_ROWS >= 0 && BOARD_VISIBLE_ROWS >= 4, "there have to be some rows to see");
+
+/*
+ * Logging. The level is picked when compiling (-DLOG_LEVEL=0/1/2), release builds (-DNDEBUG) only keep the errors and
+ * everything below the level is not compiled at all, so the debug lines cost nothing there.
+ * The messages never go to stdout, that is where the game is drawn. They go to the log fd, which is the file given
+ * with --log or stderr if that is not the terminal we are drawing on. Debug messages without a log fd are dropped.
+ */
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_DEBUG 2
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL LOG_LEVEL_ERROR
+#else
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+int logFd = -1; // set up in main
+
+#if LOG_LEVEL > LOG_LEVEL_OFF
+// one write per message so lines from different threads don't get mixed up
+static void logMessage(int fd, const char *prefix, const char *format, ...) {
+    char line[512];
+    int length = snprintf(line, sizeof(line), "%s: ", prefix);
+    va_list args;
+    va_start(args, format);
+    length += vsnprintf(line + length, sizeof(line) - length - 1, format, args);
+    va_end(args);
+    if (length > (int)sizeof(line) - 2) {
+        length = sizeof(line) - 2;
+    }
+    line[length++] = '\n';
+    if (write(fd, line, length) < 0) {
+        // nowhere left to report this
+    }
+}
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logMessage(logFd >= 0 ? logFd : STDERR_FILENO, "ERROR", __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) do { if (logFd >= 0) logMessage(logFd, "DEBUG", __VA_ARGS__); } while (0)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+/*
+ * Counters for what the hot paths do and histograms of how long frames take, so we can see where the time goes.
+ * Every thread counts into its own block (aligned to a cache line, so the game farm threads never share one) with
+ * relaxed loads and stores, which is a plain add and no locked instruction. The blocks are in a list and summed when
+ * they are dumped, and a thread that ends adds its counts to the retired ones first (the farm and replay workers end
+ * when their share is done). kill -USR1 dumps them to the log fd (or stderr) at any time and --stats at exit.
+ * -DNO_STATS compiles all of it out.
+ */
+typedef enum {
+    COUNTER_COLLISIONS, // positions tested
+    COUNTER_PLACEMENTS, // pieces locked
+    COUNTER_LINES,
+    COUNTER_RENDERS,
+    COUNTER_TERMINAL_BYTES, // frames written to the terminal
+    COUNTER_SOCKET_BYTES, // sent to players and spectators
+    NUM_OF_COUNTERS
+} e_Counter;
+
+typedef enum {
+    HISTOGRAM_FRAME, // one displayGame
+    HISTOGRAM_INPUT, // from reading a key to the frame that shows it
+    NUM_OF_HISTOGRAMS
+} e_Histogram;
+
+#define HISTOGRAM_BUCKETS 40 // bucket b counts times below 2^b ns, the last one everything longer
+#define MAX_STATS_THREADS 1024
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t counters[NUM_OF_COUNTERS];
+    _Atomic uint64_t histograms[NUM_OF_HISTOGRAMS][HISTOGRAM_BUCKETS];
+} s_Stats;
+
+uint64_t monotonicNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+#ifdef NO_STATS
+#define countStat(counter, n) ((void)sizeof(n))
+#define recordTime(histogram, nanos) ((void)sizeof(nanos))
+#define statsClock() 0ull
+#else
+#define statsClock() monotonicNanos() // only read for the histograms, no need to ask the clock without them
+
+static const char *const COUNTER_NAMES[NUM_OF_COUNTERS] = { "collisions", "placements", "lines", "renders",
+                                                            "terminal bytes", "socket bytes" };
+static const char *const HISTOGRAM_NAMES[NUM_OF_HISTOGRAMS] = { "frame", "input to frame" };
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t statsKey; // its destructor retires the block of a thread that ends
+static s_Stats *statsThreads[MAX_STATS_THREADS];
+static int statsThreadCount = 0;
+static s_Stats retiredStats; // of the threads that are gone, and of the ones that did not fit into the list
+static _Thread_local s_Stats *threadStats = NULL;
+
+static void addStats(s_Stats *to, const s_Stats *from) {
+    for (int i = 0; i < NUM_OF_COUNTERS; i++) {
+        atomic_fetch_add_explicit(&to->counters[i], atomic_load_explicit(&from->counters[i], memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+    for (int h = 0; h < NUM_OF_HISTOGRAMS; h++) {
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            atomic_fetch_add_explicit(&to->histograms[h][b],
+                                      atomic_load_explicit(&from->histograms[h][b], memory_order_relaxed),
+                                      memory_order_relaxed);
+        }
+    }
+}
+
+static void retireStats(void *argument) {
+    s_Stats *stats = argument;
+    pthread_mutex_lock(&statsLock);
+    addStats(&retiredStats, stats);
+    for (int i = 0; i < statsThreadCount; i++) {
+        if (statsThreads[i] == stats) {
+            statsThreads[i] = statsThreads[--statsThreadCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&statsLock);
+    free(stats);
+    threadStats = NULL;
+}
+
+static void createStatsKey() {
+    pthread_key_create(&statsKey, retireStats);
+}
+
+// the first count of a thread gets it its block
+static s_Stats *registerStats() {
+    pthread_once(&statsOnce, createStatsKey);
+    s_Stats *stats = aligned_alloc(64, sizeof(s_Stats));
+    pthread_mutex_lock(&statsLock);
+    if (stats && statsThreadCount < MAX_STATS_THREADS) {
+        memset(stats, 0, sizeof(*stats));
+        statsThreads[statsThreadCount++] = stats;
+        pthread_setspecific(statsKey, stats);
+    } else {
+        free(stats);
+        stats = &retiredStats; // shared with the other ones that did not fit, they only ever add to it
+    }
+    pthread_mutex_unlock(&statsLock);
+    threadStats = stats;
+    return stats;
+}
+
+static inline s_Stats *currentStats() {
+    return threadStats ? threadStats : registerStats();
+}
+
+static inline void countStat(e_Counter counter, uint64_t n) {
+    s_Stats *stats = currentStats();
+    if (stats == &retiredStats) {
+        atomic_fetch_add_explicit(&stats->counters[counter], n, memory_order_relaxed);
+        return;
+    }
+    // only this thread ever writes it, so no need for a locked add
+    uint64_t value = atomic_load_explicit(&stats->counters[counter], memory_order_relaxed);
+    atomic_store_explicit(&stats->counters[counter], value + n, memory_order_relaxed);
+}
+
+static inline void recordTime(e_Histogram histogram, uint64_t nanos) {
+    int bucket = nanos ? 64 - __builtin_clzll(nanos) : 0;
+    _Atomic uint64_t *count = &currentStats()->histograms[histogram][bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1];
+    atomic_fetch_add_explicit(count, 1, memory_order_relaxed); // much rarer than the counters, once per frame
+}
+#endif
+
+// all the threads together, one write so it does not get mixed into other output
+void dumpStats(int fd) {
+#ifdef NO_STATS
+    dprintf(fd, "stats: compiled out (NO_STATS)\n");
+#else
+    s_Stats total;
+    memset(&total, 0, sizeof(total));
+    pthread_mutex_lock(&statsLock);
+    addStats(&total, &retiredStats);
+    for (int i = 0; i < statsThreadCount; i++) {
+        addStats(&total, statsThreads[i]);
+    }
+    int threads = statsThreadCount;
+    pthread_mutex_unlock(&statsLock);
+
+    char text[1024];
+    int length = snprintf(text, sizeof(text), "stats (%d threads running):", threads);
+    for (int i = 0; i < NUM_OF_COUNTERS; i++) {
+        length += snprintf(text + length, sizeof(text) - length, " %s %llu", COUNTER_NAMES[i],
+                           (unsigned long long)atomic_load(&total.counters[i]));
+    }
+    length += snprintf(text + length, sizeof(text) - length, "\n");
+    for (int h = 0; h < NUM_OF_HISTOGRAMS; h++) {
+        uint64_t count = 0;
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            count += atomic_load(&total.histograms[h][b]);
+        }
+        length += snprintf(text + length, sizeof(text) - length, "%s: %llu", HISTOGRAM_NAMES[h], (unsigned long long)count);
+        // the percentiles are the upper end of the bucket they fall into
+        static const int PERCENTILES[] = { 50, 90, 99, 100 };
+        for (int p = 0; p < 4 && count > 0; p++) {
+            uint64_t seen = 0;
+            int b = 0;
+            while (b < HISTOGRAM_BUCKETS - 1 && (seen += atomic_load(&total.histograms[h][b])) * 100 < count * PERCENTILES[p]) {
+                b++;
+            }
+            length += snprintf(text + length, sizeof(text) - length, " p%d <%.1fus", PERCENTILES[p],
+                               (double)(1ull << b) / 1000);
+        }
+        length += snprintf(text + length, sizeof(text) - length, "\n");
+    }
+    if (write(fd, text, length) < 0) {
+        // nowhere left to report this
+    }
+#endif
+}
+
+#ifndef TETRIS_LIBRARY // the library leaves the signals to the program it is in
+// kill -USR1 dumps the stats, one thread does nothing but wait for it so no other one is ever interrupted
+static void *statsSignalThread(void *argument) {
+    const sigset_t *signals = argument;
+    for (;;) {
+        int signal;
+        if (sigwait(signals, &signal) == 0) {
+            dumpStats(logFd >= 0 ? logFd : STDERR_FILENO);
+        }
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Memory for the things that come and go all the time, so none of them goes through malloc while the game runs.
+ * An arena is one block that is handed out from the front and given back all at once (or back to a mark, like a
+ * stack), every search thread has its own and it is empty again at the end of every move.
+ * A pool hands out objects of one size from slabs of many of them and keeps the ones that are given back on a free
+ * list for the next one, the server has one for its sessions, spectators and broadcasts. It only ever grows, by a
+ * slab at a time, and everything goes back to the system when the pool is freed.
+ * Neither of them locks, they belong to one thread.
+ */
+#define ARENA_ALIGNMENT 16
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+} s_Arena;
+
+bool initArena(s_Arena *arena, size_t size) {
+    arena->size = (size + 63) & ~(size_t)63;
+    arena->used = 0;
+    arena->base = aligned_alloc(64, arena->size);
+    return arena->base != NULL;
+}
+
+void freeArena(s_Arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+}
+
+// NULL when it is full, the arenas are sized for the most they will ever have to hold
+static inline void *arenaAlloc(s_Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+    void *memory = arena->base + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+// everything allocated after the mark is given back
+static inline size_t arenaMark(const s_Arena *arena) {
+    return arena->used;
+}
+
+static inline void arenaRelease(s_Arena *arena, size_t mark) {
+    arena->used = mark;
+}
+
+static inline void resetArena(s_Arena *arena) {
+    arena->used = 0;
+}
+
+typedef struct {
+    size_t objectSize; // a multiple of the cache line, two objects never share one
+    int objectsPerSlab;
+    void *free; // the first bytes of a free object point to the next free one
+    void *slabs; // the first cache line of a slab points to the next slab
+} s_Pool;
+
+void initPool(s_Pool *pool, size_t objectSize, int objectsPerSlab) {
+    pool->objectSize = (objectSize + 63) & ~(size_t)63;
+    pool->objectsPerSlab = objectsPerSlab;
+    pool->free = NULL;
+    pool->slabs = NULL;
+}
+
+// NULL if there is no memory for another slab, the object has whatever was in it before so the caller clears what
+// it needs cleared (a session does not need its few kB of screen zeroed)
+void *poolAlloc(s_Pool *pool) {
+    if (!pool->free) {
+        uint8_t *slab = aligned_alloc(64, 64 + pool->objectsPerSlab * pool->objectSize);
+        if (!slab) {
+            return NULL;
+        }
+        *(void **)slab = pool->slabs;
+        pool->slabs = slab;
+        // the first object ends up at the head of the list, so a new slab is handed out in order
+        for (int i = pool->objectsPerSlab - 1; i >= 0; i--) {
+            void *object = slab + 64 + i * pool->objectSize;
+            *(void **)object = pool->free;
+            pool->free = object;
+        }
+    }
+    void *object = pool->free;
+    pool->free = *(void **)object;
+    return object;
+}
+
+void poolFree(s_Pool *pool, void *object) {
+    *(void **)object = pool->free;
+    pool->free = object;
+}
+
+void freePool(s_Pool *pool) {
+    while (pool->slabs) {
+        void *next = *(void **)pool->slabs;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->free = NULL;
+}
 
 // first we need the function for setting up the terminal on mac
 // since the terminal is only used for in the mode where a user types something and then presses the enter key
@@ -75,46 +471,209 @@ void resetTerminal() {
     tcsetattr(0, TCSANOW, &term);
     fcntl(0, F_SETFL, fcntl(0, F_GETFL) & ~O_NONBLOCK); // here we use & and bitwise NOT this turns off the blocking, now the terminal waits for the input again
 }
+/*
+ * The keys are read in batches, everything that is waiting on stdin comes in with one read into a ring buffer and all
+ * of it is played before the next frame is drawn, so a fast burst of keys (or a pasted one) is one frame and not many.
+ * The arrow keys are escape sequences, ESC [ A for up (ESC O A when the terminal is in application mode) and B, C, D
+ * for down, right and left, decodeKey turns them into the letters they stand for.
+ */
+#define INPUT_RING_SIZE 256 // a power of two, the positions are masked with it
+
+// where the escape parser is between two bytes
+typedef enum {
+    INPUT_KEY,
+    INPUT_ESCAPE, // after ESC
+    INPUT_SEQUENCE // after ESC [ or ESC O, the parameters and then the letter come next
+} e_InputState;
+
+typedef struct {
+    uint8_t bytes[INPUT_RING_SIZE];
+    uint32_t head; // the next byte to decode, head and tail only ever count up
+    uint32_t tail; // where the next read goes
+    uint8_t state; // an e_InputState, a sequence can be split over two reads
+} s_InputRing;
+
+// feeds one byte through the escape parser, true when it finished a key and the key is in key
+bool decodeKey(uint8_t *state, uint8_t byte, char *key) {
+    if (*state == INPUT_SEQUENCE) {
+        if (byte < 0x40 || byte > 0x7e) {
+            return false; // a parameter, like the modifiers in ESC [ 1 ; 5 C
+        }
+        *state = INPUT_KEY;
+        switch (byte) {
+            case 'A': *key = 'w'; return true;
+            case 'B': *key = 's'; return true;
+            case 'C': *key = 'd'; return true;
+            case 'D': *key = 'a'; return true;
+            default: return false; // some other key we don't play with
+        }
+    }
+    if (*state == INPUT_ESCAPE) {
+        *state = INPUT_KEY;
+        if (byte == '[' || byte == 'O') {
+            *state = INPUT_SEQUENCE;
+            return false;
+        }
+        // just the escape key and then a normal one, the escape is dropped
+    }
+    if (byte == 0x1b) {
+        *state = INPUT_ESCAPE;
+        return false;
+    }
+    *key = (char)byte;
+    return true;
+}
+
 /*
 
-// we make a function for checking if a key is pressed in the terminal in the first place
+// we make a function for reading the keys that were pressed in the terminal in the first place
+// everything that is there goes into the ring, we return how many bytes that was, 0 for nothing there and -1 when stdin is gone
 
 */
-int keybit() {
-    char ch;
-    int bytes = read(0, &ch, 1); 
+int readKeys(s_InputRing *ring, int fd) {
+    uint32_t space = INPUT_RING_SIZE - (ring->tail - ring->head);
+    uint32_t start = ring->tail & (INPUT_RING_SIZE - 1);
+    uint32_t first = space < INPUT_RING_SIZE - start ? space : INPUT_RING_SIZE - start;
+    if (space == 0) {
+        return 0; // full, the keys stay in the terminal until we played these
+    }
+    // the free part of the ring can wrap around its end, readv fills both pieces in the same call
+    struct iovec parts[2] = { { ring->bytes + start, first }, { ring->bytes, space - first } };
+    ssize_t bytes = readv(fd, parts, space > first ? 2 : 1);
     /*
     // this is to read nbytes from the file descriptor so here reading from stdinput so fd is 0
-    // so if it returns correctly it needs to return nbytes so if we press arrow keys that is one key each containing some value and that value is char so 1 byte 
-    // if correct we return that, and if it is not read correctly it will return -1 and errno is called
+    // if it is not read correctly it will return -1 and errno is called, 0 bytes means the end of the input
     */
-    if (bytes == 1) {
-        return 1;
-    } else if (bytes == -1 && errno == EAGAIN) {
+    if (bytes > 0) {
+        ring->tail += bytes;
+        return (int)bytes;
+    } else if (bytes == -1 && (errno == EAGAIN || errno == EINTR)) {
         return 0;
     } else {
-        perror("Error reading correct number of bytes");
-        return EXIT_FAILURE;
+        if (bytes == -1) {
+            LOG_ERROR("Error reading correct number of bytes: %s", strerror(errno));
+        }
+        return -1;
+    }
+}
+
+// the next key from the ring, false once it is empty (a sequence that is not complete yet waits for the next read)
+bool nextKey(s_InputRing *ring, char *key) {
+    while (ring->head != ring->tail) {
+        if (decodeKey(&ring->state, ring->bytes[ring->head++ & (INPUT_RING_SIZE - 1)], key)) {
+            return true;
+        }
     }
+    return false;
 }
 
-// function to get the pressed key 
-int getch() {
-    char ch;
-    read(0, &ch, 1);
-    return ch;
+// the game loop sleeps in poll() and wakes up for a key or when the next drop is due, for that we need a clock
+// that is wall time and never jumps, CLOCK_MONOTONIC is exactly that
+uint64_t monotonicMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
-//this will be our game board
-char board[BOARD_HEIGHT][BOARD_WIDTH]; 
+/*
+ * The game logic does not run on wall time directly but on fixed ticks. The scheduler collects the wall time that passed
+ * in an accumulator and hands out whole ticks, the remainder is kept for the next time. Everything timed in the game
+ * (gravity right now) is counted in ticks, so it runs at the same rate no matter how long drawing took or when we woke up.
+ */
+#define TICK_MICROS 1000 // one tick is 1 ms
+#define MAX_CATCH_UP_TICKS 1000 // if we were stopped for longer than this (ctrl-z) we don't replay all of it
 
-// now we initialize that board and set it all to empty, we populate the board
-void initBoard() {
-    for (int y = 0; y < BOARD_HEIGHT; y++) {
-        for (int x = 0; x < BOARD_WIDTH; x++) {
-            board[y][x] = EMPTY_CELL;
+typedef struct {
+    uint64_t lastTime; // monotonic time of the last update
+    uint64_t accumulator; // wall time that was not turned into a tick yet
+    uint64_t tick; // ticks since the start of the game
+} s_TickScheduler;
+
+void initScheduler(s_TickScheduler *scheduler, uint64_t now) {
+    scheduler->lastTime = now;
+    scheduler->accumulator = 0;
+    scheduler->tick = 0;
+}
+
+// turns the time since the last call into ticks and returns how many ticks passed
+uint64_t advanceScheduler(s_TickScheduler *scheduler, uint64_t now) {
+    scheduler->accumulator += now - scheduler->lastTime;
+    scheduler->lastTime = now;
+    uint64_t ticks = scheduler->accumulator / TICK_MICROS;
+    scheduler->accumulator -= ticks * TICK_MICROS;
+    if (ticks > MAX_CATCH_UP_TICKS) {
+        ticks = MAX_CATCH_UP_TICKS;
+    }
+    scheduler->tick += ticks;
+    return ticks;
+}
+
+// how long in microseconds we can sleep before the given tick is reached
+uint64_t microsUntilTick(const s_TickScheduler *scheduler, uint64_t tick) {
+    if (tick <= scheduler->tick) {
+        return 0;
+    }
+    return (tick - scheduler->tick) * TICK_MICROS - scheduler->accumulator;
+}
+
+//this will be our game board, one bitmask per row (see board_row_t above)
+// it is a struct and not a global so that every game (and every copy a bot wants to try things on) has its own
+// next to the rows we keep the height of every column (how many rows up from the bottom its highest block is),
+// placing and clearing keep it up to date so finding where a piece lands does not have to walk down the board
+// there are also a few rows below the bottom that always stay empty, so four rows can be read from wherever a piece
+// starts without checking (the AVX2 batch collision test does that)
+// and every change sets the bit of the row it happened in, whoever draws the board (or sends it somewhere) takes
+// the mask with takeDirtyRows and only has to look at those rows
+#define BOARD_PADDING_ROWS 3
+#define ALL_BOARD_ROWS (~0ull >> (64 - BOARD_HEIGHT))
+#define VISIBLE_BOARD_ROWS (ALL_BOARD_ROWS & ~((1ull << BOARD_HIDDEN_ROWS) - 1))
+
+typedef struct {
+    board_row_t rows[BOARD_HEIGHT + BOARD_PADDING_ROWS];
+    uint8_t heights[BOARD_WIDTH];
+    uint64_t dirtyRows; // bit y is set when row y changed since the last takeDirtyRows
+} s_Board;
+
+_Static_assert(BOARD_HEIGHT <= 64, "the dirty rows are a 64 bit mask");
+
+// the rows that changed since the last time this was called
+static inline uint64_t takeDirtyRows(s_Board *board) {
+    uint64_t dirty = board->dirtyRows;
+    board->dirtyRows = 0;
+    return dirty;
+}
+
+// now we initialize that board and set it all to empty, since empty is 0 this is just clearing the words
+void initBoard(s_Board *board) {
+    memset(board, 0, sizeof(*board));
+}
+
+// works the heights out from the rows again, for boards that were filled in by hand
+// from the top down, a column gets its height in the first row where it has a block
+void updateHeights(s_Board *board, int firstRow) {
+    board_row_t unresolved = FULL_ROW_MASK;
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        if (board->heights[x] > BOARD_HEIGHT - firstRow) {
+            unresolved &= ~CELL_BIT(x); // the top of this column is above the rows we look at, so it is already right
+        }
+    }
+    for (int y = firstRow; y < BOARD_HEIGHT && unresolved; y++) {
+        board_row_t found = board->rows[y] & unresolved;
+        unresolved &= ~found;
+        while (found) {
+            board->heights[__builtin_ctz(found)] = BOARD_HEIGHT - y;
+            found &= found - 1;
         }
     }
+    while (unresolved) {
+        board->heights[__builtin_ctz(unresolved)] = 0; // nothing in this column at all
+        unresolved &= unresolved - 1;
+    }
+}
+
+// small helper so we don't have to think about the bits everywhere
+static inline bool isCellFilled(const s_Board *board, int x, int y) {
+    return (board->rows[y] & CELL_BIT(x)) != 0;
 }
 
 /* 
@@ -132,12 +691,15 @@ typedef enum {
     NUM_OF_SHAPES // to see how many shapes we will have get it
 } e_TetrominoType; // e_ indicates it is an enum so we can remember better
 
+// bytes are plenty and keep it at 4 bytes, the move generator queues thousands of these and the game state has one
 typedef struct {
-    int x, y;
-    e_TetrominoType type;
-    int rotation; // this goes from 0 to 3, because we can have 0 deg which is neutral position, after that we have 90 deg, 180 deg, 270deg
+    int8_t x, y;
+    uint8_t type; // an e_TetrominoType
+    uint8_t rotation; // this goes from 0 to 3, because we can have 0 deg which is neutral position, after that we have 90 deg, 180 deg, 270deg
 } s_Tetromino;
 
+_Static_assert(BOARD_WIDTH < 100 && BOARD_HEIGHT < 100, "piece positions are stored in a byte");
+
 // here 1 represents an area that is filled and 0 represents and area which is empty cell, empty space
 const int TETROMINO_SHAPE[NUM_OF_SHAPES][4][4][4] = {
     // I_SHAPE now first this is at index 0
@@ -368,33 +930,279 @@ const int TETROMINO_SHAPE[NUM_OF_SHAPES][4][4][4] = {
     }
 };
 
-// lets now make a function where we actually make a new tetromino
-void createTetronino(s_Tetromino *tetromino) {
-    tetromino->type = rand() % NUM_OF_SHAPES; // here we decide which type it is going to be, something randomlly of course
+/*
+ * The 4x4 table above is nice to read but slow to use, every check walks all 16 entries even though a piece has only 4 cells.
+ * So for each type and rotation we also keep a compact version of the same shape (derived by hand from TETROMINO_SHAPE, the
+ * debug build checks that they still agree):
+ *   - the four cell offsets inside the 4x4 box
+ *   - the min/max extents of those cells
+ *   - the rows of the piece as bitmasks, starting at row minY and shifted so that column minX is bit 0
+ * one entry is 16 bytes so all four rotations of a piece sit in a single 64 byte cache line
+ */
+typedef struct {
+    int8_t cells[4][2]; // x, y of every filled cell inside the 4x4 box
+    int8_t minX, maxX, minY, maxY;
+    uint8_t rowMask[4]; // rowMask[r] is box row minY + r, bit 0 is box column minX
+} s_TetrominoInfo;
+
+_Static_assert(sizeof(s_TetrominoInfo) == 16, "four rotations of a piece should fill one cache line");
+
+_Alignas(64) const s_TetrominoInfo TETROMINO_INFO[NUM_OF_SHAPES][4] = {
+    // I_SHAPE
+    {
+        { { {0, 1}, {1, 1}, {2, 1}, {3, 1} }, 0, 3, 1, 1, { 0xf, 0x0, 0x0, 0x0 } },
+        { { {2, 0}, {2, 1}, {2, 2}, {2, 3} }, 2, 2, 0, 3, { 0x1, 0x1, 0x1, 0x1 } },
+        { { {0, 2}, {1, 2}, {2, 2}, {3, 2} }, 0, 3, 2, 2, { 0xf, 0x0, 0x0, 0x0 } },
+        { { {1, 0}, {1, 1}, {1, 2}, {1, 3} }, 1, 1, 0, 3, { 0x1, 0x1, 0x1, 0x1 } }
+    },
+    // O_SHAPE
+    {
+        { { {1, 1}, {2, 1}, {1, 2}, {2, 2} }, 1, 2, 1, 2, { 0x3, 0x3, 0x0, 0x0 } },
+        { { {1, 1}, {2, 1}, {1, 2}, {2, 2} }, 1, 2, 1, 2, { 0x3, 0x3, 0x0, 0x0 } },
+        { { {1, 1}, {2, 1}, {1, 2}, {2, 2} }, 1, 2, 1, 2, { 0x3, 0x3, 0x0, 0x0 } },
+        { { {1, 1}, {2, 1}, {1, 2}, {2, 2} }, 1, 2, 1, 2, { 0x3, 0x3, 0x0, 0x0 } }
+    },
+    // T_SHAPE
+    {
+        { { {1, 1}, {0, 2}, {1, 2}, {2, 2} }, 0, 2, 1, 2, { 0x2, 0x7, 0x0, 0x0 } },
+        { { {1, 1}, {1, 2}, {2, 2}, {1, 3} }, 1, 2, 1, 3, { 0x1, 0x3, 0x1, 0x0 } },
+        { { {0, 2}, {1, 2}, {2, 2}, {1, 3} }, 0, 2, 2, 3, { 0x7, 0x2, 0x0, 0x0 } },
+        { { {1, 1}, {0, 2}, {1, 2}, {1, 3} }, 0, 1, 1, 3, { 0x2, 0x3, 0x2, 0x0 } }
+    },
+    // J_SHAPE
+    {
+        { { {0, 1}, {0, 2}, {1, 2}, {2, 2} }, 0, 2, 1, 2, { 0x1, 0x7, 0x0, 0x0 } },
+        { { {1, 1}, {2, 1}, {1, 2}, {1, 3} }, 1, 2, 1, 3, { 0x3, 0x1, 0x1, 0x0 } },
+        { { {0, 2}, {1, 2}, {2, 2}, {2, 3} }, 0, 2, 2, 3, { 0x7, 0x4, 0x0, 0x0 } },
+        { { {1, 1}, {1, 2}, {0, 3}, {1, 3} }, 0, 1, 1, 3, { 0x2, 0x2, 0x3, 0x0 } }
+    },
+    // L_SHAPE
+    {
+        { { {2, 1}, {0, 2}, {1, 2}, {2, 2} }, 0, 2, 1, 2, { 0x4, 0x7, 0x0, 0x0 } },
+        { { {1, 1}, {1, 2}, {1, 3}, {2, 3} }, 1, 2, 1, 3, { 0x1, 0x1, 0x3, 0x0 } },
+        { { {0, 2}, {1, 2}, {2, 2}, {0, 3} }, 0, 2, 2, 3, { 0x7, 0x1, 0x0, 0x0 } },
+        { { {0, 1}, {1, 1}, {1, 2}, {1, 3} }, 0, 1, 1, 3, { 0x3, 0x2, 0x2, 0x0 } }
+    },
+    // S_SHAPE
+    {
+        { { {1, 1}, {2, 1}, {0, 2}, {1, 2} }, 0, 2, 1, 2, { 0x6, 0x3, 0x0, 0x0 } },
+        { { {1, 1}, {1, 2}, {2, 2}, {2, 3} }, 1, 2, 1, 3, { 0x1, 0x3, 0x2, 0x0 } },
+        { { {1, 2}, {2, 2}, {0, 3}, {1, 3} }, 0, 2, 2, 3, { 0x6, 0x3, 0x0, 0x0 } },
+        { { {0, 1}, {0, 2}, {1, 2}, {1, 3} }, 0, 1, 1, 3, { 0x1, 0x3, 0x2, 0x0 } }
+    },
+    // Z_SHAPE
+    {
+        { { {0, 1}, {1, 1}, {1, 2}, {2, 2} }, 0, 2, 1, 2, { 0x3, 0x6, 0x0, 0x0 } },
+        { { {2, 1}, {1, 2}, {2, 2}, {1, 3} }, 1, 2, 1, 3, { 0x2, 0x3, 0x1, 0x0 } },
+        { { {0, 2}, {1, 2}, {1, 3}, {2, 3} }, 0, 2, 2, 3, { 0x3, 0x6, 0x0, 0x0 } },
+        { { {1, 1}, {0, 2}, {1, 2}, {0, 3} }, 0, 1, 1, 3, { 0x2, 0x3, 0x1, 0x0 } }
+    }
+};
+
+/*
+ * Wall kicks, the rotations are SRS: the shapes above turn around the same centers as in SRS (the middle of the 4x4 box
+ * for I and O, the middle of the 3x3 box in its bottom three rows for the others), so when a piece does not fit after
+ * turning it tries the other spots of the SRS tables in their order and goes to the first one it fits in. The tables
+ * are the SRS ones with y pointing down like on our board. The first test is always where it is.
+ */
+#define KICK_TESTS 5
+
+typedef enum {
+    KICKS_JLSTZ,
+    KICKS_I,
+    KICKS_O, // turning O changes nothing, so it never needs to move
+    NUM_OF_KICK_CLASSES
+} e_KickClass;
+
+typedef struct {
+    int8_t x, y;
+} s_Kick;
+
+const uint8_t TETROMINO_KICK_CLASS[NUM_OF_SHAPES] = { KICKS_I, KICKS_O, KICKS_JLSTZ, KICKS_JLSTZ, KICKS_JLSTZ,
+                                                      KICKS_JLSTZ, KICKS_JLSTZ };
+const uint8_t KICK_TEST_COUNT[NUM_OF_KICK_CLASSES] = { KICK_TESTS, KICK_TESTS, 1 };
+
+// [class][rotation it turns from][0 clockwise, 1 counter clockwise][test]
+const s_Kick TETROMINO_KICKS[NUM_OF_KICK_CLASSES][4][2][KICK_TESTS] = {
+    // KICKS_JLSTZ
+    {
+        { { {0, 0}, {-1, 0}, {-1, -1}, {0, 2}, {-1, 2} }, { {0, 0}, {1, 0}, {1, -1}, {0, 2}, {1, 2} } },
+        { { {0, 0}, {1, 0}, {1, 1}, {0, -2}, {1, -2} }, { {0, 0}, {1, 0}, {1, 1}, {0, -2}, {1, -2} } },
+        { { {0, 0}, {1, 0}, {1, -1}, {0, 2}, {1, 2} }, { {0, 0}, {-1, 0}, {-1, -1}, {0, 2}, {-1, 2} } },
+        { { {0, 0}, {-1, 0}, {-1, 1}, {0, -2}, {-1, -2} }, { {0, 0}, {-1, 0}, {-1, 1}, {0, -2}, {-1, -2} } }
+    },
+    // KICKS_I
+    {
+        { { {0, 0}, {-2, 0}, {1, 0}, {-2, 1}, {1, -2} }, { {0, 0}, {-1, 0}, {2, 0}, {-1, -2}, {2, 1} } },
+        { { {0, 0}, {-1, 0}, {2, 0}, {-1, -2}, {2, 1} }, { {0, 0}, {2, 0}, {-1, 0}, {2, -1}, {-1, 2} } },
+        { { {0, 0}, {2, 0}, {-1, 0}, {2, -1}, {-1, 2} }, { {0, 0}, {1, 0}, {-2, 0}, {1, 2}, {-2, -1} } },
+        { { {0, 0}, {1, 0}, {-2, 0}, {1, 2}, {-2, -1} }, { {0, 0}, {-2, 0}, {1, 0}, {-2, 1}, {1, -2} } }
+    },
+    // KICKS_O
+    { { { {0, 0} }, { {0, 0} } }, { { {0, 0} }, { {0, 0} } }, { { {0, 0} }, { {0, 0} } }, { { {0, 0} }, { {0, 0} } } }
+};
+
+#ifndef NDEBUG
+// debug builds make sure nobody changed one of the tables without the other
+static void checkTetrominoInfo() {
+    for (int type = 0; type < NUM_OF_SHAPES; type++) {
+        for (int rotation = 0; rotation < 4; rotation++) {
+            const s_TetrominoInfo *info = &TETROMINO_INFO[type][rotation];
+            int filled = 0;
+            for (int y = 0; y < 4; y++) {
+                for (int x = 0; x < 4; x++) {
+                    bool inMask = y >= info->minY && y <= info->maxY && x >= info->minX &&
+                                  ((info->rowMask[y - info->minY] >> (x - info->minX)) & 1);
+                    if (TETROMINO_SHAPE[type][rotation][y][x] != inMask) {
+                        fprintf(stderr, "TETROMINO_INFO does not match TETROMINO_SHAPE (type=%d, rotation=%d)\n", type, rotation);
+                        abort();
+                    }
+                    filled += inMask;
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                if (!TETROMINO_SHAPE[type][rotation][info->cells[i][1]][info->cells[i][0]]) {
+                    filled = -1;
+                }
+            }
+            if (filled != 4) {
+                fprintf(stderr, "TETROMINO_INFO cells are wrong (type=%d, rotation=%d)\n", type, rotation);
+                abort();
+            }
+            // the kicks are only right if turning the cells clockwise around the SRS center gives the next rotation,
+            // the center is counted in half cells so it can be between two of them
+            int centerX = TETROMINO_KICK_CLASS[type] == KICKS_JLSTZ ? 2 : 3;
+            int centerY = TETROMINO_KICK_CLASS[type] == KICKS_JLSTZ ? 4 : 3;
+            for (int i = 0; i < 4; i++) {
+                int x = (centerX - (info->cells[i][1] * 2 - centerY)) / 2;
+                int y = (centerY + (info->cells[i][0] * 2 - centerX)) / 2;
+                if (!TETROMINO_SHAPE[type][(rotation + 1) % 4][y][x]) {
+                    fprintf(stderr, "TETROMINO_SHAPE does not turn like SRS (type=%d, rotation=%d)\n", type, rotation);
+                    abort();
+                }
+            }
+        }
+    }
+}
+#endif
+
+/*
+ * Random numbers: every game carries its own small generator instead of using rand(), so games on different threads
+ * never share (or lock) anything and a game can be played again exactly from its seed. It is PCG32 (a 64 bit LCG with a
+ * permuted 32 bit output) with a fixed increment, so the whole state is 8 bytes.
+ */
+typedef struct {
+    uint64_t state;
+} s_Random;
+
+#define PCG_MULTIPLIER 6364136223846793005ull
+#define PCG_INCREMENT 1442695040888963407ull
+
+static inline uint32_t nextRandom(s_Random *random) {
+    uint64_t old = random->state;
+    random->state = old * PCG_MULTIPLIER + PCG_INCREMENT;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rotation = (uint32_t)(old >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+// seeds that are close together (seed, seed + 1, ...) should still give unrelated games, so the seed is mixed first
+void seedRandom(s_Random *random, uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    random->state = z ^ (z >> 31);
+    nextRandom(random);
+}
+
+// a number from 0 to bound - 1 without the bias that % has (Lemire's multiply and reject)
+static inline uint32_t randomBelow(s_Random *random, uint32_t bound) {
+    uint64_t product = (uint64_t)nextRandom(random) * bound;
+    uint32_t low = (uint32_t)product;
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            product = (uint64_t)nextRandom(random) * bound;
+            low = (uint32_t)product;
+        }
+    }
+    return (uint32_t)(product >> 32);
+}
+
+/*
+ * Which piece comes next. Uniform is what the game always did, every piece is picked on its own.
+ * The 7-bag puts all seven pieces in a bag and draws them out one by one before refilling it, so you never wait more
+ * than 12 pieces for a certain one. The bag is just a bitmask of the pieces still in it.
+ */
+typedef enum {
+    RANDOMIZER_UNIFORM,
+    RANDOMIZER_BAG
+} e_Randomizer;
+
+#define FULL_BAG ((1u << NUM_OF_SHAPES) - 1)
+
+typedef struct {
+    s_Random random;
+    uint8_t randomizer; // an e_Randomizer
+    uint8_t bag; // bit t is set while piece t is still in the bag
+} s_PieceSequence;
+
+void initPieceSequence(s_PieceSequence *sequence, uint64_t seed, e_Randomizer randomizer) {
+    seedRandom(&sequence->random, seed);
+    sequence->randomizer = randomizer;
+    sequence->bag = FULL_BAG;
+}
+
+e_TetrominoType nextPieceType(s_PieceSequence *sequence) {
+    if (sequence->randomizer == RANDOMIZER_UNIFORM) {
+        return (e_TetrominoType)randomBelow(&sequence->random, NUM_OF_SHAPES);
+    }
+    // pick the n-th of the pieces that are left in the bag
+    uint32_t n = randomBelow(&sequence->random, __builtin_popcount(sequence->bag));
+    uint8_t left = sequence->bag;
+    while (n-- > 0) {
+        left &= left - 1; // drops the lowest piece
+    }
+    int type = __builtin_ctz(left);
+    sequence->bag &= ~(1u << type);
+    if (sequence->bag == 0) {
+        sequence->bag = FULL_BAG;
+    }
+    return (e_TetrominoType)type;
+}
+
+// the piece at its spawn position, without a word about it, the search makes one of these for every board it looks at
+void spawnTetromino(s_Tetromino *tetromino, e_TetrominoType type) {
+    tetromino->type = type; // here we decide which type it is going to be, the piece sequence of the game picks it
     tetromino->rotation = 0; // initially it is set to 0
     tetromino->x = BOARD_WIDTH / 2 - 2; // this is needed in order to center the tetromino whichever we will be using.
-    tetromino->y = 0; // we start at the very top of the board
+    // we start at the very top of the board, or with hidden rows right above the visible part so it shows up at once
+    tetromino->y = BOARD_HIDDEN_ROWS > 2 ? BOARD_HIDDEN_ROWS - 2 : 0;
+}
+
+// lets now make a function where we actually make a new tetromino
+void createTetronino(s_Tetromino *tetromino, e_TetrominoType type) {
+    spawnTetromino(tetromino, type);
     // for debugging
-    printf("Created tetromino: type=%d, x=%d, y=%d\n", tetromino->type, tetromino->x, tetromino->y);
+    LOG_DEBUG("Created tetromino: type=%d, x=%d, y=%d", tetromino->type, tetromino->x, tetromino->y);
 }
 
 // we also need a function which checks whether this tetromino is in the right position
-bool is_in_valid_position(s_Tetromino *tetromino) {
-    for (int x = 0; x < 4; x++) {
-        for (int y = 0; y < 4; y++) {
-            // we make a tetromino and we check if this one exists
-            if (TETROMINO_SHAPE[tetromino->type][tetromino->rotation][y][x]) { // if it is a valid one, type and rotation will be passed when we create the piece
-                int boardX = tetromino->x + x;
-                int boardY = tetromino->y + y;
-                // we check if it is outside of the board and so forth...
-                if (boardX < 0 || boardX >= BOARD_WIDTH || boardY < 0 || boardY >= BOARD_HEIGHT) {
-                    return false;
-                }
-                // now we check if it is overlapping with some existing blocks on the board already
-                if (board[boardY][boardX] != EMPTY_CELL) {
-                    return false; // position is invalid, we have a collision
-                }
-            }
+bool is_in_valid_position(const s_Board *board, const s_Tetromino *tetromino) {
+    countStat(COUNTER_COLLISIONS, 1);
+    const s_TetrominoInfo *info = &TETROMINO_INFO[tetromino->type][tetromino->rotation];
+    int left = tetromino->x + info->minX;
+    int top = tetromino->y + info->minY;
+
+    // we check if it is outside of the board and so forth, the extents tell us that without looking at the cells
+    if (left < 0 || tetromino->x + info->maxX >= BOARD_WIDTH || top < 0 || tetromino->y + info->maxY >= BOARD_HEIGHT) {
+        return false;
+    }
+
+    // now we check if it is overlapping with some existing blocks on the board already, one AND per row of the piece
+    for (int r = 0; r <= info->maxY - info->minY; r++) {
+        if (board->rows[top + r] & ((board_row_t)info->rowMask[r] << left)) {
+            return false; // position is invalid, we have a collision
         }
     }
     // if we got to this part so far, that means 
@@ -402,9 +1210,9 @@ bool is_in_valid_position(s_Tetromino *tetromino) {
 }
 
 // now we need to implement the movement of the tetromino's
-bool moveTetrominoDown(s_Tetromino *tetromino) {
+bool moveTetrominoDown(const s_Board *board, s_Tetromino *tetromino) {
     tetromino->y++;
-    if (!is_in_valid_position(tetromino)) {
+    if (!is_in_valid_position(board, tetromino)) {
         tetromino->y--;
         return false;
     }
@@ -413,9 +1221,9 @@ bool moveTetrominoDown(s_Tetromino *tetromino) {
 }
 
 
-bool moveTetrominoLeft(s_Tetromino *tetromino) {
+bool moveTetrominoLeft(const s_Board *board, s_Tetromino *tetromino) {
     tetromino->x--; 
-    if (!is_in_valid_position(tetromino)) {
+    if (!is_in_valid_position(board, tetromino)) {
         tetromino->x++; // if we can't go left anymore
         return false;
     }
@@ -423,9 +1231,9 @@ bool moveTetrominoLeft(s_Tetromino *tetromino) {
     return true;
 }
 
-bool moveTetrominoRight(s_Tetromino *tetromino) {
+bool moveTetrominoRight(const s_Board *board, s_Tetromino *tetromino) {
     tetromino->x++; // moving right so positive
-    if (!is_in_valid_position(tetromino)) {
+    if (!is_in_valid_position(board, tetromino)) {
         tetromino->x--;
         return false;
     }
@@ -433,239 +1241,4467 @@ bool moveTetrominoRight(s_Tetromino *tetromino) {
     return true;
 }
 
-// now we need to do the tetromino rotations
-bool rotateTetromino(s_Tetromino *tetromino) {
-    int defaultRotation = tetromino->rotation; // this is the rotation that we have once the tetromino spawns
-    int newRotation = (tetromino->rotation + 1) % 4; // since we have 4 rotations this ensures that we get a new one, so for example this let's us get rotations from 0 to 3
-    tetromino->rotation = newRotation;
-    if (!is_in_valid_position(tetromino)) {
-        tetromino->rotation = defaultRotation;
-        return false;
+// moves the piece as far as it goes to one side in one go, the same as moving it a column at a time until it can't,
+// returns how many columns that was. If the piece is above the stack in all the columns it goes through nothing can be
+// in the way and the heights say that without looking at the rows, otherwise it is one move after the other
+int slideTetromino(const s_Board *board, s_Tetromino *tetromino, int direction) {
+    const s_TetrominoInfo *info = &TETROMINO_INFO[tetromino->type][tetromino->rotation];
+    int wall = direction < 0 ? -info->minX : BOARD_WIDTH - 1 - info->maxX; // where the piece touches the wall
+    // every column a cell can get into on the way, that is the ones of the piece too except the one it leaves first
+    int first = direction < 0 ? 0 : tetromino->x + info->minX + 1;
+    int last = direction < 0 ? tetromino->x + info->maxX - 1 : BOARD_WIDTH - 1;
+    int bottom = tetromino->y + info->maxY;
+    bool clear = true;
+    for (int x = first; x <= last; x++) {
+        clear &= BOARD_HEIGHT - board->heights[x] > bottom; // the top block of the column is below the piece
     }
-
-    return true;
+    int start = tetromino->x;
+    if (clear) {
+        tetromino->x = (int8_t)wall;
+    } else {
+        while (direction < 0 ? moveTetrominoLeft(board, tetromino) : moveTetrominoRight(board, tetromino)) {
+        }
+    }
+    return direction < 0 ? start - tetromino->x : tetromino->x - start;
 }
 
-void placeTetromino(s_Tetromino *tetromino) {
-    for (int x = 0; x < 4; x++) {
-        for (int y = 0; y < 4; y++) {
-            if(TETROMINO_SHAPE[tetromino->type][tetromino->rotation][y][x]) {
-                int boardX = tetromino->x + x;
-                int boardY = tetromino->y + y;
-                board[boardY][boardX] = FILLED_CELL; // adding this correction, was wrong before
-            }
+// turns the piece and tries the kicks from firstKick on
+static bool kickTetromino(const s_Board *board, s_Tetromino *tetromino, int direction, int firstKick) {
+    int turn = direction < 0; // the index of the direction in the kick table
+    int kickClass = TETROMINO_KICK_CLASS[tetromino->type];
+    const s_Kick *kicks = TETROMINO_KICKS[kickClass][tetromino->rotation][turn];
+    s_Tetromino rotated = *tetromino;
+    rotated.rotation = (tetromino->rotation + (turn ? 3 : 1)) % 4; // since we have 4 rotations this ensures that we get a new one, so for example this let's us get rotations from 0 to 3
+    for (int i = firstKick; i < KICK_TEST_COUNT[kickClass]; i++) {
+        rotated.x = tetromino->x + kicks[i].x;
+        rotated.y = tetromino->y + kicks[i].y;
+        if (is_in_valid_position(board, &rotated)) {
+            *tetromino = rotated;
+            return true;
         }
     }
+    return false; // no spot fits, it stays the way it was
 }
 
+// now we need to do the tetromino rotations, direction 1 is clockwise and -1 counter clockwise
+bool rotateTetromino(const s_Board *board, s_Tetromino *tetromino, int direction) {
+    return kickTetromino(board, tetromino, direction, 0);
+}
 
-// now we need to add a function to display the game itself in the first place
-void displayGame(s_Tetromino *tetromino) {
-    // now we need to use ANSI escape codes since we are using the terminal and first we will clear the terminal
-    printf("\033[H\033[J"); // this is the ANSI escape code for making and clearing the space
-
-    // now lets make a board with the tetromino
-    char tempBoard[BOARD_HEIGHT][BOARD_WIDTH];
-
-    // we make a copy of the board now
-    for (int i = 0; i < BOARD_HEIGHT; i++) {
-        for (int j = 0; j < BOARD_WIDTH; j++) {
-            tempBoard[i][j] = board[i][j];
+void placeTetromino(s_Board *board, const s_Tetromino *tetromino) {
+    const s_TetrominoInfo *info = &TETROMINO_INFO[tetromino->type][tetromino->rotation];
+    int left = tetromino->x + info->minX;
+    int top = tetromino->y + info->minY;
+    for (int r = 0; r <= info->maxY - info->minY; r++) {
+        board->rows[top + r] |= (board_row_t)info->rowMask[r] << left;
+    }
+    board->dirtyRows |= ((1ull << (info->maxY - info->minY + 1)) - 1) << top;
+    // the columns under the piece can only get higher
+    for (int i = 0; i < 4; i++) {
+        int x = tetromino->x + info->cells[i][0];
+        int height = BOARD_HEIGHT - (tetromino->y + info->cells[i][1]);
+        if (height > board->heights[x]) {
+            board->heights[x] = height;
         }
     }
+}
 
-    // now that we have a copy of the board we now add our tetromino to the current temp board
-    for (int x = 0; x < 4; x++) {
-        for (int y = 0; y < 4; y++) {
-            if (TETROMINO_SHAPE[tetromino->type][tetromino->rotation][y][x]) {
-                int boardX = tetromino->x + x;
-                int boardY = tetromino->y + y;
-
-                if (boardX >= 0 && boardX < BOARD_WIDTH && boardY >= 0 && boardY < BOARD_HEIGHT) {
-                    tempBoard[boardY][boardX] = FILLED_CELL; // adding '#' for this
-                }
-            }
+// where the piece ends up if it falls straight down from where it is now, this is the y it lands on
+// a column can't be fallen through above its highest block, so as long as the piece is above all the columns
+// it covers the height map gives the answer right away, four cells and no stepping
+// only when the piece was tucked in under an overhang we have to step it down the normal way
+int landingRow(const s_Board *board, const s_Tetromino *tetromino) {
+    const s_TetrominoInfo *info = &TETROMINO_INFO[tetromino->type][tetromino->rotation];
+    int landing = BOARD_HEIGHT;
+    for (int i = 0; i < 4; i++) {
+        int x = tetromino->x + info->cells[i][0];
+        int limit = BOARD_HEIGHT - board->heights[x] - 1 - info->cells[i][1]; // the lowest y this cell allows
+        if (limit < landing) {
+            landing = limit;
         }
     }
-
-    // now once we filled this tetromino with the elements we now draw the border finally
-    printf("+");
-    for (int x = 0; x < BOARD_WIDTH; x++) {
-        printf("-");
+    if (landing >= tetromino->y) {
+        return landing;
     }
-    printf("+\n");
 
-    // now the left vertical lines
-    for(int y = 0; y < BOARD_HEIGHT; y++) {
-        printf("|");
+    s_Tetromino falling = *tetromino;
+    while (moveTetrominoDown(board, &falling)) {
+    }
+    return falling.y;
+}
+
+
+// now we need to move the lines, clear the lines:
+// only the rows covered by the piece that was just placed can have become complete, so that is all we look at
+int clearLines(s_Board *board, const s_Tetromino *placed) {
+    const s_TetrominoInfo *info = &TETROMINO_INFO[placed->type][placed->rotation];
+    int top = placed->y + info->minY;
+    int bottom = placed->y + info->maxY;
+    int linesCleared = 0;
+
+    // one pass from the bottom of the piece upwards, every surviving row is copied down to the write cursor
+    int write = bottom;
+    for (int read = bottom; read >= top; read--) {
+        // with the bitboard a complete line is just a single compare
+        if (board->rows[read] == FULL_ROW_MASK) {
+            linesCleared++;
+            continue;
+        }
+        board->rows[write--] = board->rows[read];
+    }
+
+    if (linesCleared > 0) {
+        // everything above the piece just moves down by the number of cleared lines in one go
+        memmove(&board->rows[linesCleared], &board->rows[0], top * sizeof(board_row_t));
+        // and the rows that opened up at the top are empty
+        memset(board->rows, 0, linesCleared * sizeof(board_row_t));
+        board->dirtyRows |= ~0ull >> (63 - bottom); // every row down to the piece moved
+
+        // a column whose top was above the cleared rows just sank by the number of lines, which is what
+        // updateHeights leaves alone, the others are looked up again starting where their blocks can be now
+        for (int x = 0; x < BOARD_WIDTH; x++) {
+            if (board->heights[x] > BOARD_HEIGHT - top) {
+                board->heights[x] -= linesCleared;
+            } else {
+                board->heights[x] = 0;
+            }
+        }
+        updateHeights(board, top + linesCleared < BOARD_HEIGHT ? top + linesCleared : BOARD_HEIGHT);
+    }
+
+    return linesCleared;
+}
+
+// now we implement the conditional statement for the game itself and this is if the game will be over or not
+bool isGameOver(const s_Board *board) {
+    // if there are filled cells in the top row the game is over that is one condition, now let's write it
+    return board->rows[0] != 0;
+}
+
+#define NEXT_PIECES 5 // how many of the coming pieces are known in advance (shown to the player, used by bots)
+
+/*
+ * Everything that makes up one game lives in this struct, the board, the falling piece and the score.
+ * Nothing in here knows about the terminal, so a game can be played without one (see the headless mode below)
+ * and as many games as we want can exist at the same time.
+ * It is plain data with no pointers, so a copy of the struct is a copy of the game (see snapshotGame). It is 184 bytes
+ * on the 20 wide board and 128 on a 10 wide one, most of it is the board, the rest is the padding at the end of the
+ * piece sequence. The level and the drop speed follow from the lines (gameLevel) and statistics of a whole game are
+ * kept by whoever wants them (s_GameStats), so none of that is in here. initGame zeroes all of it, so two equal games
+ * are still equal bytes.
+ */
+typedef struct {
+    s_Board board;
+    s_Tetromino piece;
+    int score;
+    int linesCleared;
+    int piecesPlaced;
+    uint8_t next[NEXT_PIECES]; // the pieces that come after the current one, next[0] is the very next
+    bool gameOver;
+    uint64_t tick; // game time in scheduler ticks
+    uint64_t lastDropTick; // tick of the last gravity drop (or soft drop, which resets it)
+    uint64_t seed; // the game can be played again from this
+    s_PieceSequence pieces;
+} s_GameState;
+
+// we need to level up every 10 lines, so if we go from anything below 10 lines the level stays the same
+static inline int gameLevel(const s_GameState *game) {
+    return game->linesCleared / 10 + 1;
+}
+
+// in microseconds, 0.5 seconds on the first level and faster everytime as we reach a level
+static inline int dropSpeed(const s_GameState *game) {
+    return 500000 / gameLevel(game);
+}
+
+// the things a player (or a bot) can do, one step of the game is one of these
+typedef enum {
+    ACTION_NONE,
+    ACTION_LEFT,
+    ACTION_RIGHT,
+    ACTION_ROTATE,
+    ACTION_ROTATE_BACK, // counter clockwise
+    ACTION_SOFT_DROP,
+    ACTION_HARD_DROP,
+    NUM_OF_ACTIONS
+} e_Action;
+
+// the next piece from the queue comes in at the top and a new one is drawn at the end of the queue
+static void spawnPiece(s_GameState *game) {
+    createTetronino(&game->piece, game->next[0]);
+    memmove(game->next, game->next + 1, NEXT_PIECES - 1);
+    game->next[NEXT_PIECES - 1] = nextPieceType(&game->pieces);
+}
+
+void initGame(s_GameState *game, uint64_t seed, e_Randomizer randomizer) {
+    // one memset is the empty board, the zero score and ticks and the padding too, so two equal games are equal bytes
+    memset(game, 0, sizeof(*game));
+    game->seed = seed;
+    initPieceSequence(&game->pieces, seed, randomizer);
+    for (int i = 0; i < NEXT_PIECES; i++) {
+        game->next[i] = nextPieceType(&game->pieces);
+    }
+    spawnPiece(game); // now we make that piece 
+}
+
+// the piece could not go down anymore, so it becomes part of the board and the next one comes in
+// returns the number of lines that this cleared
+int lockPiece(s_GameState *game) {
+    placeTetromino(&game->board, &game->piece);
+    game->piecesPlaced++;
+    int lines = clearLines(&game->board, &game->piece);
+    countStat(COUNTER_PLACEMENTS, 1);
+    countStat(COUNTER_LINES, lines);
+    if (lines > 0) {
+        game->score += lines * 100 * gameLevel(game); // this is the algorithm I am going for for loading the score
+        game->linesCleared += lines; // and with that the level goes up every 10 lines, see gameLevel
+    }
+    spawnPiece(game); // we make a new piece now
+    if (!is_in_valid_position(&game->board, &game->piece)) {
+        game->gameOver = true; 
+    }
+    return lines;
+}
+
+// moves the piece one down or locks it if that is not possible, returns the lines cleared
+static int dropPiece(s_GameState *game) {
+    if (!moveTetrominoDown(&game->board, &game->piece)) {
+        return lockPiece(game);
+    }
+    return 0;
+}
+
+// one step of the game, returns the number of lines the action cleared
+int stepGame(s_GameState *game, e_Action action) {
+    if (game->gameOver) {
+        return 0;
+    }
+    switch (action) {
+        case ACTION_LEFT:
+            moveTetrominoLeft(&game->board, &game->piece); // moving the tetromino left
+            break;
+        case ACTION_RIGHT:
+            moveTetrominoRight(&game->board, &game->piece); // moving the tetromino right
+            break;
+        case ACTION_ROTATE:
+            rotateTetromino(&game->board, &game->piece, 1); // rotating the tetromino
+            break;
+        case ACTION_ROTATE_BACK:
+            rotateTetromino(&game->board, &game->piece, -1);
+            break;
+        case ACTION_SOFT_DROP:
+            // this is for moving down, it also resets the gravity timer
+            game->lastDropTick = game->tick;
+            return dropPiece(game);
+        case ACTION_HARD_DROP:
+            // straight down to where it lands and stays there
+            game->piece.y = landingRow(&game->board, &game->piece);
+            game->lastDropTick = game->tick;
+            return lockPiece(game);
+        default:
+            break;
+    }
+    return 0;
+}
+
+static uint64_t dropTicks(const s_GameState *game) {
+    uint64_t ticks = dropSpeed(game) / TICK_MICROS;
+    return ticks > 0 ? ticks : 1; // on very high levels it would round down to nothing
+}
+
+// lets the given number of ticks pass, every drop that became due happens on its own tick
+// so the rate stays exact no matter in how big chunks the time comes in, returns the lines cleared
+int advanceGame(s_GameState *game, uint64_t ticks) {
+    int lines = 0;
+    uint64_t target = game->tick + ticks;
+    while (!game->gameOver && target - game->lastDropTick >= dropTicks(game)) {
+        game->lastDropTick += dropTicks(game);
+        game->tick = game->lastDropTick;
+        lines += dropPiece(game);
+    }
+    game->tick = target;
+    return lines;
+}
+
+// the tick at which the next gravity drop is going to happen
+uint64_t nextDropTick(const s_GameState *game) {
+    return game->lastDropTick + dropTicks(game);
+}
+
+// a copy of the game to go back to later, e.g. to try something and undo it
+static inline void snapshotGame(const s_GameState *game, s_GameState *snapshot) {
+    memcpy(snapshot, game, sizeof(*snapshot));
+}
+
+// the board is a different one now, so whoever shows it has to draw it all again
+static inline void restoreGame(s_GameState *game, const s_GameState *snapshot) {
+    memcpy(game, snapshot, sizeof(*game));
+    game->board.dirtyRows = ALL_BOARD_ROWS;
+}
+
+/*
+ * Saving a game to a file, it is the struct as it is in memory behind a small header. The header has everything the
+ * layout depends on (the size, the board and the byte order), a file from a different build is refused instead of
+ * being read wrong.
+ */
+#define SAVE_MAGIC "TSAV"
+#define SAVE_VERSION 4 // 4 has no level, drop speed, piece counts or stack height anymore
+#define SAVE_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t width;
+    uint8_t height;
+    uint8_t nextPieces;
+    uint8_t hiddenRows; // doesn't change the layout but where the pieces spawn
+    uint32_t size;
+    uint32_t byteOrder;
+} s_SaveHeader;
+
+static void initSaveHeader(s_SaveHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SAVE_MAGIC, 4);
+    header->version = SAVE_VERSION;
+    header->width = BOARD_WIDTH;
+    header->height = BOARD_HEIGHT;
+    header->nextPieces = NEXT_PIECES;
+    header->hiddenRows = BOARD_HIDDEN_ROWS;
+    header->size = sizeof(s_GameState);
+    header->byteOrder = SAVE_BYTE_ORDER;
+}
+
+bool saveGame(const s_GameState *game, const char *path) {
+    struct {
+        s_SaveHeader header;
+        s_GameState game;
+    } file;
+    initSaveHeader(&file.header);
+    snapshotGame(game, &file.game);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the save file %s: %s", path, strerror(errno));
+        return false;
+    }
+    ssize_t written = write(fd, &file, sizeof(file));
+    if (written != (ssize_t)sizeof(file)) {
+        LOG_ERROR("Error writing the save file %s: %s", path, written < 0 ? strerror(errno) : "short write");
+        close(fd);
+        return false;
+    }
+    return close(fd) == 0;
+}
+
+bool loadGame(s_GameState *game, const char *path) {
+    struct {
+        s_SaveHeader header;
+        s_GameState game;
+    } file;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the save file %s: %s", path, strerror(errno));
+        return false;
+    }
+    ssize_t got = read(fd, &file, sizeof(file));
+    close(fd);
+    s_SaveHeader expected;
+    initSaveHeader(&expected);
+    if (got != (ssize_t)sizeof(file) || memcmp(&file.header, &expected, sizeof(expected)) != 0) {
+        LOG_ERROR("%s is not a game saved by this build", path);
+        return false;
+    }
+    // the layout is right, but the values index tables so they get a look too
+    const s_GameState *saved = &file.game;
+    bool valid = saved->piece.type < NUM_OF_SHAPES && saved->piece.rotation < 4 &&
+                 saved->pieces.randomizer <= RANDOMIZER_BAG && saved->pieces.bag != 0 && saved->pieces.bag <= FULL_BAG;
+    for (int i = 0; i < NEXT_PIECES; i++) {
+        valid = valid && saved->next[i] < NUM_OF_SHAPES;
+    }
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        valid = valid && saved->board.heights[x] <= BOARD_HEIGHT;
+    }
+    for (int y = 0; y < BOARD_HEIGHT + BOARD_PADDING_ROWS; y++) {
+        valid = valid && (saved->board.rows[y] & ~(y < BOARD_HEIGHT ? FULL_ROW_MASK : 0)) == 0;
+    }
+    // only a game that is still going is saved, so its piece has to be somewhere it can be (that also keeps x and y
+    // inside the board, everything that moves or draws the piece indexes with them)
+    valid = valid && !saved->gameOver && is_in_valid_position(&saved->board, &saved->piece);
+    if (!valid) {
+        LOG_ERROR("The save file %s is broken", path);
+        return false;
+    }
+    restoreGame(game, saved);
+    return true;
+}
+
+/*
+ * Testing a lot of positions at once, for whoever has a pile of candidates to check: one call and a bit per candidate.
+ * With AVX2 that is eight candidates per vector: the candidates are 4 bytes each, so eight of them are one load and
+ * x, y, type and rotation come out with shifts. The extents and the row masks of every lane are gathered from
+ * TETROMINO_INFO (an entry is 16 bytes, the extents at byte 8 and the masks at 12), the edges are checked for all
+ * eight at once, and then for each of the four piece rows the board row is gathered and ANDed with that row of the
+ * piece shifted to the x of its lane (a shift per lane, which SSE2 does not have). There are no branches, the lanes
+ * outside the board or past count don't load anything and are not in the result. The board has empty rows below the
+ * bottom so four rows from the top of any piece that is inside are always there (with 16 bit rows the gather reads
+ * 32 bits and the last one goes two bytes into the heights, still inside the board, the top half is masked off).
+ * SSE2 and NEON versions didn't beat is_in_valid_position, finding the box and the rows of a candidate is most of
+ * the work and they have no gathers for it, so without AVX2 it is that one by one. The CPU is asked at run time,
+ * the binary does not need -mavx2.
+ */
+#define COLLISION_BATCH 16
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX2_BATCH 1
+__attribute__((target("avx2")))
+static uint32_t batchValidPositionsAvx2(const s_Board *board, const s_Tetromino *candidates, int count) {
+    countStat(COUNTER_COLLISIONS, count);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i byte = _mm256_set1_epi32(0xFF);
+    const __m256i none = _mm256_set1_epi32(-1);
+    const int *info = (const int *)TETROMINO_INFO;
+    uint32_t valid = 0;
+    for (int i = 0; i < count; i += 8) {
+        __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32(count - i), lanes);
+        __m256i packed = _mm256_maskload_epi32((const int *)&candidates[i], live);
+        __m256i x = _mm256_srai_epi32(_mm256_slli_epi32(packed, 24), 24);
+        __m256i y = _mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 24);
+        // in ints, the entry of type and rotation starts at (type * 4 + rotation) * 4, a gather scales by 8 at most
+        __m256i entry = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(packed, 16), byte), 3),
+                                         _mm256_slli_epi32(_mm256_srli_epi32(packed, 24), 1));
+        __m256i extents = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), info + 2, entry, live, 8);
+        __m256i masks = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), info + 3, entry, live, 8);
+        __m256i left = _mm256_add_epi32(x, _mm256_srai_epi32(_mm256_slli_epi32(extents, 24), 24));
+        __m256i right = _mm256_add_epi32(x, _mm256_srai_epi32(_mm256_slli_epi32(extents, 16), 24));
+        __m256i top = _mm256_add_epi32(y, _mm256_srai_epi32(_mm256_slli_epi32(extents, 8), 24));
+        __m256i bottom = _mm256_add_epi32(y, _mm256_srai_epi32(extents, 24));
+        __m256i horizontal = _mm256_and_si256(_mm256_cmpgt_epi32(left, none),
+                                              _mm256_cmpgt_epi32(_mm256_set1_epi32(BOARD_WIDTH), right));
+        __m256i vertical = _mm256_and_si256(_mm256_cmpgt_epi32(top, none),
+                                            _mm256_cmpgt_epi32(_mm256_set1_epi32(BOARD_HEIGHT), bottom));
+        __m256i inside = _mm256_and_si256(live, _mm256_and_si256(horizontal, vertical));
+        left = _mm256_and_si256(left, inside);
+        __m256i hits = _mm256_setzero_si256();
+        for (int r = 0; r < 4; r++) {
+            __m256i row = _mm256_add_epi32(top, _mm256_set1_epi32(r));
+            __m256i rows = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)board->rows, row, inside,
+                                                      sizeof(board_row_t));
+#if BOARD_ROW_BITS == 16
+            rows = _mm256_and_si256(rows, _mm256_set1_epi32(0xFFFF));
+#endif
+            __m256i piece = _mm256_sllv_epi32(_mm256_and_si256(_mm256_srli_epi32(masks, 8 * r), byte), left);
+            hits = _mm256_or_si256(hits, _mm256_and_si256(rows, piece));
+        }
+        __m256i clear = _mm256_and_si256(inside, _mm256_cmpeq_epi32(hits, _mm256_setzero_si256()));
+        valid |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(clear)) << i;
+    }
+    return valid;
+}
+#else
+#define HAVE_AVX2_BATCH 0
+#endif
+
+// bit i of the result is set when candidates[i] is a valid position, count can be up to COLLISION_BATCH
+uint32_t batchValidPositions(const s_Board *board, const s_Tetromino *candidates, int count) {
+#if HAVE_AVX2_BATCH
+    if (__builtin_cpu_supports("avx2")) {
+        return batchValidPositionsAvx2(board, candidates, count);
+    }
+#endif
+    uint32_t valid = 0;
+    for (int i = 0; i < count; i++) {
+        valid |= (uint32_t)is_in_valid_position(board, &candidates[i]) << i;
+    }
+    return valid;
+}
+
+/*
+ * Move generation for bots: every distinct spot the current piece can come to rest in, using only what a player can
+ * do (left, right, both rotations with their kicks and dropping one row). It is a search over (x, y, rotation)
+ * starting from where the piece is, done a whole row of x at a time: for every rotation and y there is a word with a
+ * bit for each x where the piece fits and one for each x it can get to. Sliding left and right is filling the bits
+ * through the run of fitting ones they are in, dropping is ANDing with the row below, and a rotation tries each kick
+ * on all the bits that are still left with one shift and AND, in the same order rotateTetromino tries them. A row
+ * that got new bits is looked at again until nothing changes. A spot where the piece can't move down is a placement.
+ * Some rotations are the same shape (all four of O, two each of I, S and Z), just shifted inside the 4x4 box, so the
+ * same cells on the board can be reached as different (x, y, rotation). Every placement is turned into the first
+ * rotation with that shape first, so each one comes out only once.
+ */
+typedef struct {
+    int8_t rotation; // the rotation with the same shape that the placement is reported as
+    int8_t dx, dy; // add these to x and y to get the position in that rotation
+} s_RotationAlias;
+
+const s_RotationAlias TETROMINO_ALIAS[NUM_OF_SHAPES][4] = {
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 1, -1, 0 } }, // I_SHAPE
+    { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } }, // O_SHAPE
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } }, // T_SHAPE
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } }, // J_SHAPE
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } }, // L_SHAPE
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 1, -1, 0 } }, // S_SHAPE
+    { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 1, -1, 0 } }  // Z_SHAPE
+};
+
+typedef struct {
+    int8_t x, y, rotation;
+} s_Placement;
+
+// the x and y a piece can have while being on the board, with room for the empty edges of the 4x4 box
+// bit x + SEARCH_X_OFFSET of a row word is that x, a board up to 32 wide still fits into 64 bits with them
+#define SEARCH_X_OFFSET 3
+#define SEARCH_Y_OFFSET 3
+#define SEARCH_COLUMNS (BOARD_WIDTH + SEARCH_X_OFFSET)
+#define SEARCH_ROWS (BOARD_HEIGHT + SEARCH_Y_OFFSET)
+#define SEARCH_STATES (SEARCH_COLUMNS * SEARCH_ROWS * 4)
+#define MAX_PLACEMENTS SEARCH_STATES // more than there can ever be, but then nobody has to check
+
+typedef struct {
+    uint64_t fits[4][SEARCH_ROWS + 1]; // the x where the piece is in a valid position, the extra row stays 0
+    uint64_t reached[4][SEARCH_ROWS];
+    uint64_t pending[4][SEARCH_ROWS]; // reached but the moves from there are not tried yet
+    uint64_t placed[4][SEARCH_ROWS + 1]; // the placements, in the rotation they are reported as
+} s_PlacementRows;
+
+static inline uint64_t shiftColumns(uint64_t bits, int dx) {
+    return dx >= 0 ? bits << dx : bits >> -dx;
+}
+
+// the x a piece in this rotation and row fits at, every cell of the piece rules out the x that put it on a block
+static uint64_t fittingColumns(const s_Board *board, const s_TetrominoInfo *info, int y) {
+    if (y + info->minY < 0 || y + info->maxY >= BOARD_HEIGHT) {
+        return 0;
+    }
+    uint64_t fits = ((1ull << (BOARD_WIDTH - info->maxX + info->minX)) - 1) << (SEARCH_X_OFFSET - info->minX);
+    for (int r = 0; r <= info->maxY - info->minY; r++) {
+        uint64_t blocks = board->rows[y + info->minY + r];
+        for (unsigned mask = info->rowMask[r], i = 0; mask; mask >>= 1, i++) {
+            if (mask & 1) {
+                fits &= ~(blocks << (SEARCH_X_OFFSET - info->minX - i));
+            }
+        }
+    }
+    return fits;
+}
+
+// spreads the bits left and right as far as the fitting ones they are in go
+static inline uint64_t slideColumns(uint64_t bits, uint64_t fits) {
+    uint64_t left = bits;
+    uint64_t right = bits;
+    uint64_t leftOpen = fits;
+    uint64_t rightOpen = fits;
+    for (int shift = 1; shift < SEARCH_COLUMNS; shift *= 2) {
+        left |= leftOpen & (left << shift);
+        leftOpen &= leftOpen << shift;
+        right |= rightOpen & (right >> shift);
+        rightOpen &= rightOpen >> shift;
+    }
+    return left | right;
+}
+
+// the piece gets to the bits of this row (they all fit), tells if any of them is new
+// what was reached is always whole runs of fitting bits, so only bits outside of it can add something
+static inline bool reachColumns(s_PlacementRows *search, int rotation, int row, uint64_t bits) {
+    bits &= ~search->reached[rotation][row];
+    if (!bits) {
+        return false;
+    }
+    bits = slideColumns(bits, search->fits[rotation][row]);
+    search->reached[rotation][row] |= bits;
+    search->pending[rotation][row] |= bits;
+    return bits != 0;
+}
+
+// fills placements with every distinct resting spot of the piece and returns how many there are
+// placements needs room for MAX_PLACEMENTS entries, the piece has to be in a valid position to begin with
+// the rows of the search come from the arena (sizeof(s_PlacementRows)) and are given back before it returns
+// most of the rows are empty ones above the stack, where the piece can get to any x and rotation anyway, so when the
+// piece starts above the open row (4x4 box and one row under it still clear of the stack) the search starts with all
+// of the open row and never goes above it. Nothing gets lost that way: a path that comes up from above ends up one
+// row under the open row (a kick moves two rows at most) and drops there from the open row too
+int generatePlacements(const s_Board *board, const s_Tetromino *piece, s_Placement *placements, s_Arena *arena) {
+    if (!is_in_valid_position(board, piece)) {
+        return 0;
+    }
+    int highest = 0;
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        highest = board->heights[x] > highest ? board->heights[x] : highest;
+    }
+    int openRow = BOARD_HEIGHT - highest - 5;
+    bool fromOpenRow = openRow >= 0 && piece->y <= openRow;
+    int firstRow = fromOpenRow ? openRow + SEARCH_Y_OFFSET : 0;
+
+    size_t mark = arenaMark(arena);
+    s_PlacementRows *search = arenaAlloc(arena, sizeof(*search));
+    memset(search, 0, sizeof(*search));
+    for (int rotation = 0; rotation < 4; rotation++) {
+        const s_TetrominoInfo *info = &TETROMINO_INFO[piece->type][rotation];
+        for (int row = firstRow; row < SEARCH_ROWS; row++) {
+            search->fits[rotation][row] = fittingColumns(board, info, row - SEARCH_Y_OFFSET);
+        }
+    }
+    if (fromOpenRow) {
+        for (int rotation = 0; rotation < 4; rotation++) {
+            reachColumns(search, rotation, firstRow, search->fits[rotation][firstRow]);
+        }
+    } else {
+        reachColumns(search, piece->rotation, piece->y + SEARCH_Y_OFFSET, 1ull << (piece->x + SEARCH_X_OFFSET));
+    }
+
+    // top to bottom, dropping only ever adds to the rows that are still to come, a kick up means another round
+    int kickClass = TETROMINO_KICK_CLASS[piece->type];
+    bool again = true;
+    while (again) {
+        again = false;
+        for (int row = firstRow; row < SEARCH_ROWS; row++) {
+            for (int rotation = 0; rotation < 4; rotation++) {
+                uint64_t bits = search->pending[rotation][row];
+                if (!bits) {
+                    continue;
+                }
+                search->pending[rotation][row] = 0;
+                if (row + 1 < SEARCH_ROWS) {
+                    reachColumns(search, rotation, row + 1, bits & search->fits[rotation][row + 1]);
+                }
+                for (int turn = 0; turn < 2; turn++) {
+                    int turned = (rotation + (turn ? 3 : 1)) % 4;
+                    const s_Kick *kicks = TETROMINO_KICKS[kickClass][rotation][turn];
+                    uint64_t left = bits; // the ones no kick has worked for so far
+                    for (int i = 0; i < KICK_TEST_COUNT[kickClass] && left; i++) {
+                        int target = row + kicks[i].y;
+                        if (target < firstRow || target >= SEARCH_ROWS) {
+                            continue;
+                        }
+                        uint64_t fits = search->fits[turned][target];
+                        uint64_t kicked = shiftColumns(left, kicks[i].x) & fits;
+                        left &= ~shiftColumns(fits, -kicks[i].x);
+                        // a rotation into the same row or one above is looked at again, the loop is past it
+                        if (reachColumns(search, turned, target, kicked) &&
+                            (target < row || (target == row && turned < rotation))) {
+                            again = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // the spots where it can't move down, in the rotation they are reported as, then written out
+    for (int rotation = 0; rotation < 4; rotation++) {
+        const s_RotationAlias *alias = &TETROMINO_ALIAS[piece->type][rotation];
+        for (int row = firstRow; row < SEARCH_ROWS; row++) {
+            uint64_t resting = search->reached[rotation][row] & ~search->fits[rotation][row + 1];
+            search->placed[alias->rotation][row + alias->dy] |= shiftColumns(resting, alias->dx);
+        }
+    }
+    int count = 0;
+    for (int rotation = 0; rotation < 4; rotation++) {
+        for (int row = firstRow; row <= SEARCH_ROWS; row++) {
+            for (uint64_t bits = search->placed[rotation][row]; bits; bits &= bits - 1) {
+                placements[count].x = (int8_t)(__builtin_ctzll(bits) - SEARCH_X_OFFSET);
+                placements[count].y = (int8_t)(row - SEARCH_Y_OFFSET);
+                placements[count].rotation = (int8_t)rotation;
+                count++;
+            }
+        }
+    }
+    arenaRelease(arena, mark);
+    return count;
+}
+
+// puts the piece at the placement and locks it there, this is how a bot makes its move, returns the lines cleared
+int applyPlacement(s_GameState *game, const s_Placement *placement) {
+    game->piece.x = placement->x;
+    game->piece.y = placement->y;
+    game->piece.rotation = placement->rotation;
+    game->lastDropTick = game->tick;
+    return lockPiece(game);
+}
+
+/*
+ * The bot. Every placement is scored with a few features of the board it leaves behind, the usual ones:
+ * aggregate height, holes and bumpiness count against it, cleared lines for it (weights from Yiyuan Lee's tuned
+ * player). Looking ahead means trying every placement of the next piece on every resulting board and so on for as
+ * many pieces as we know, the best path decides the move.
+ * The same board comes up a lot in there (two pieces placed in a different order), so results are kept in a
+ * transposition table keyed on a Zobrist hash of the board, the piece and how deep we still look.
+ * The root placements are handed out to the search threads one at a time from a shared counter, so a thread that got
+ * cheap moves just picks up the next ones. Every thread has its own table so they never wait for each other.
+ * The threads are started with the searcher and sleep on a condition variable in between, a move only wakes them.
+ */
+#define WEIGHT_HEIGHT -0.510066
+#define WEIGHT_LINES 0.760666
+#define WEIGHT_HOLES -0.35663
+#define WEIGHT_BUMPINESS -0.184483
+#define SEARCH_LOST -1e9 // the next piece could not even spawn
+#define MAX_SEARCH_DEPTH (NEXT_PIECES + 1)
+#define MAX_SEARCH_THREADS 64
+#define TABLE_BITS 16
+
+typedef struct {
+    int aggregateHeight;
+    int holes;
+    int bumpiness;
+} s_BoardFeatures;
+
+void measureBoard(const s_Board *board, s_BoardFeatures *features) {
+    features->aggregateHeight = 0;
+    features->bumpiness = 0;
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        features->aggregateHeight += board->heights[x];
+        if (x > 0) {
+            features->bumpiness += abs(board->heights[x] - board->heights[x - 1]);
+        }
+    }
+    // a hole is an empty cell with a block somewhere above it, covered collects the columns that have one
+    features->holes = 0;
+    board_row_t covered = 0;
+    for (int y = 0; y < BOARD_HEIGHT; y++) {
+        features->holes += __builtin_popcount(covered & ~board->rows[y]);
+        covered |= board->rows[y];
+    }
+}
+
+double evaluateBoard(const s_Board *board) {
+    s_BoardFeatures features;
+    measureBoard(board, &features);
+    return WEIGHT_HEIGHT * features.aggregateHeight + WEIGHT_HOLES * features.holes +
+           WEIGHT_BUMPINESS * features.bumpiness;
+}
+
+// one random key for every cell, every piece type and every search depth, key n is splitmix64 of n
+// they are constants the compiler works out, so there is nothing to make at startup, the cell table is there for the
+// biggest board we can build (64 rows of 32) and the smaller ones just use the top left of it
+#define SPLITMIX_SEED(n) (((uint64_t)(n) + 1) * 0x9e3779b97f4a7c15ull)
+#define SPLITMIX_MIX1(z) (((z) ^ ((z) >> 30)) * 0xbf58476d1ce4e5b9ull)
+#define SPLITMIX_MIX2(z) (((z) ^ ((z) >> 27)) * 0x94d049bb133111ebull)
+#define SPLITMIX_MIX3(z) ((z) ^ ((z) >> 31))
+#define ZOBRIST_KEY(n) SPLITMIX_MIX3(SPLITMIX_MIX2(SPLITMIX_MIX1(SPLITMIX_SEED(n))))
+#define ZOBRIST_4(n) ZOBRIST_KEY(n), ZOBRIST_KEY((n) + 1), ZOBRIST_KEY((n) + 2), ZOBRIST_KEY((n) + 3)
+#define ZOBRIST_16(n) ZOBRIST_4(n), ZOBRIST_4((n) + 4), ZOBRIST_4((n) + 8), ZOBRIST_4((n) + 12)
+#define ZOBRIST_ROW(y) { ZOBRIST_16((y) * 32), ZOBRIST_16((y) * 32 + 16) }
+#define ZOBRIST_ROWS_4(y) ZOBRIST_ROW(y), ZOBRIST_ROW((y) + 1), ZOBRIST_ROW((y) + 2), ZOBRIST_ROW((y) + 3)
+#define ZOBRIST_ROWS_16(y) ZOBRIST_ROWS_4(y), ZOBRIST_ROWS_4((y) + 4), ZOBRIST_ROWS_4((y) + 8), ZOBRIST_ROWS_4((y) + 12)
+
+_Static_assert(NUM_OF_SHAPES <= 8 && MAX_SEARCH_DEPTH + 1 <= 8, "there are 8 piece and 8 depth keys");
+
+static const uint64_t ZOBRIST_CELL[64][32] = { ZOBRIST_ROWS_16(0), ZOBRIST_ROWS_16(16), ZOBRIST_ROWS_16(32),
+                                               ZOBRIST_ROWS_16(48) };
+static const uint64_t ZOBRIST_PIECE[8] = { ZOBRIST_4(2048), ZOBRIST_4(2052) };
+static const uint64_t ZOBRIST_DEPTH[8] = { ZOBRIST_4(2056), ZOBRIST_4(2060) };
+
+uint64_t hashBoard(const s_Board *board) {
+    uint64_t hash = 0;
+    for (int y = 0; y < BOARD_HEIGHT; y++) {
+        board_row_t row = board->rows[y];
+        while (row) {
+            hash ^= ZOBRIST_CELL[y][__builtin_ctz(row)];
+            row &= row - 1;
+        }
+    }
+    return hash;
+}
+
+typedef struct {
+    uint64_t key;
+    float value;
+    uint32_t generation; // entries from an earlier search (other pieces coming) don't count
+} s_TableEntry;
+
+typedef struct {
+    s_TableEntry entries[1 << TABLE_BITS];
+} s_TranspositionTable;
+
+// everything one search thread needs for itself
+typedef struct {
+    s_TranspositionTable *table;
+    uint32_t generation;
+    uint8_t pieces[MAX_SEARCH_DEPTH]; // the piece at every depth, the current one first
+    int depth;
+    uint64_t nodes;
+    s_Arena arena; // the placements of every depth, and in the first thread the root work of the move
+} s_SearchContext;
+
+// what the threads of one search share, the root moves and where their values go
+typedef struct {
+    const s_Board *board;
+    uint64_t hash;
+    const s_Placement *placements;
+    int count;
+    atomic_int nextPlacement;
+    double values[MAX_PLACEMENTS];
+} s_RootWork;
+
+// the helper threads stay for as long as the searcher and sleep between moves, the lock guards everything below it
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // there is a new move, or it is time to go
+    pthread_cond_t done; // the last helper is through with the move
+    uint32_t move; // counts the moves, a helper works when it is not the one it did last
+    int busy; // helpers still on the current move
+    bool stopping;
+    s_RootWork *work;
+} s_SearchPool;
+
+typedef struct {
+    s_SearchPool *pool;
+    s_SearchContext *context;
+} s_SearchThread;
+
+typedef struct {
+    int threads;
+    int depth; // how many pieces to place, 1 is just the current one
+    uint32_t generation;
+    double value; // of the move picked last
+    s_SearchContext contexts[MAX_SEARCH_THREADS];
+    s_SearchPool pool;
+    int helpers; // the threads that did start, the calling thread is the first search thread and not one of them
+    pthread_t handles[MAX_SEARCH_THREADS];
+    s_SearchThread helperThreads[MAX_SEARCH_THREADS];
+} s_Searcher;
+
+// a list of placements for the root and for every depth below it, the root work and the rows of one move generation
+#define SEARCH_ARENA_SIZE ((MAX_SEARCH_DEPTH + 1) * (MAX_PLACEMENTS * sizeof(s_Placement) + ARENA_ALIGNMENT) + \
+                           sizeof(s_RootWork) + sizeof(s_PlacementRows) + 2 * ARENA_ALIGNMENT)
+
+void destroySearcher(s_Searcher *searcher);
+static void *searchHelper(void *argument);
+
+s_Searcher *createSearcher(int depth, int threads) {
+    s_Searcher *searcher = calloc(1, sizeof(s_Searcher));
+    if (!searcher) {
+        return NULL;
+    }
+    pthread_mutex_init(&searcher->pool.lock, NULL);
+    pthread_cond_init(&searcher->pool.wake, NULL);
+    pthread_cond_init(&searcher->pool.done, NULL);
+    searcher->threads = threads < 1 ? 1 : threads > MAX_SEARCH_THREADS ? MAX_SEARCH_THREADS : threads;
+    searcher->depth = depth < 1 ? 1 : depth > MAX_SEARCH_DEPTH ? MAX_SEARCH_DEPTH : depth;
+    for (int i = 0; i < searcher->threads; i++) {
+        s_SearchContext *context = &searcher->contexts[i];
+        context->table = calloc(1, sizeof(s_TranspositionTable));
+        if (!context->table || !initArena(&context->arena, SEARCH_ARENA_SIZE)) {
+            destroySearcher(searcher); // the contexts that did not get there yet are still all zero
+            return NULL;
+        }
+    }
+    // if some helpers don't start the ones that did do all of it
+    for (int t = 1; t < searcher->threads; t++) {
+        s_SearchThread *thread = &searcher->helperThreads[searcher->helpers];
+        thread->pool = &searcher->pool;
+        thread->context = &searcher->contexts[t];
+        if (pthread_create(&searcher->handles[searcher->helpers], NULL, searchHelper, thread) != 0) {
+            break;
+        }
+        searcher->helpers++;
+    }
+    return searcher;
+}
+
+void destroySearcher(s_Searcher *searcher) {
+    if (!searcher) {
+        return;
+    }
+    pthread_mutex_lock(&searcher->pool.lock);
+    searcher->pool.stopping = true;
+    pthread_cond_broadcast(&searcher->pool.wake);
+    pthread_mutex_unlock(&searcher->pool.lock);
+    for (int t = 0; t < searcher->helpers; t++) {
+        pthread_join(searcher->handles[t], NULL);
+    }
+    pthread_mutex_destroy(&searcher->pool.lock);
+    pthread_cond_destroy(&searcher->pool.wake);
+    pthread_cond_destroy(&searcher->pool.done);
+    for (int i = 0; i < searcher->threads; i++) {
+        free(searcher->contexts[i].table);
+        freeArena(&searcher->contexts[i].arena);
+    }
+    free(searcher);
+}
+
+static double searchBoard(s_SearchContext *context, const s_Board *board, uint64_t hash, int depth);
+
+// places the piece of this depth at the placement and scores what comes after it
+static double searchPlacement(s_SearchContext *context, const s_Board *board, uint64_t hash, int depth,
+                              const s_Placement *placement) {
+    s_Board after = *board;
+    s_Tetromino piece = { placement->x, placement->y, context->pieces[depth], placement->rotation };
+    placeTetromino(&after, &piece);
+    int lines = clearLines(&after, &piece);
+    context->nodes++;
+
+    if (depth + 1 >= context->depth) {
+        return WEIGHT_LINES * lines + evaluateBoard(&after);
+    }
+    // without cleared lines the hash only changes by the four new cells
+    if (lines == 0) {
+        const s_TetrominoInfo *info = &TETROMINO_INFO[piece.type][piece.rotation];
+        for (int i = 0; i < 4; i++) {
+            hash ^= ZOBRIST_CELL[piece.y + info->cells[i][1]][piece.x + info->cells[i][0]];
+        }
+    } else {
+        hash = hashBoard(&after);
+    }
+    return WEIGHT_LINES * lines + searchBoard(context, &after, hash, depth + 1);
+}
+
+// the best we can do on this board with the piece of this depth and everything after it
+static double searchBoard(s_SearchContext *context, const s_Board *board, uint64_t hash, int depth) {
+    uint64_t key = hash ^ ZOBRIST_PIECE[context->pieces[depth]] ^ ZOBRIST_DEPTH[depth];
+    s_TableEntry *entry = &context->table->entries[key & ((1 << TABLE_BITS) - 1)];
+    if (entry->key == key && entry->generation == context->generation) {
+        return entry->value;
+    }
+
+    s_Tetromino piece;
+    spawnTetromino(&piece, context->pieces[depth]);
+    size_t mark = arenaMark(&context->arena);
+    s_Placement *placements = arenaAlloc(&context->arena, MAX_PLACEMENTS * sizeof(*placements));
+    int count = generatePlacements(board, &piece, placements, &context->arena);
+    double best = SEARCH_LOST;
+    for (int i = 0; i < count; i++) {
+        double value = searchPlacement(context, board, hash, depth, &placements[i]);
+        if (value > best) {
+            best = value;
+        }
+    }
+    arenaRelease(&context->arena, mark);
+
+    entry->key = key;
+    entry->value = (float)best;
+    entry->generation = context->generation;
+    // the same as a hit gives back, otherwise the value of a board depends on whether the thread that got there had it
+    // in its table already, and the threads get the root moves in a different order every time
+    return entry->value;
+}
+
+static void searchRootMoves(s_RootWork *work, s_SearchContext *context) {
+    for (;;) {
+        int i = atomic_fetch_add(&work->nextPlacement, 1);
+        if (i >= work->count) {
+            break;
+        }
+        work->values[i] = searchPlacement(context, work->board, work->hash, 0, &work->placements[i]);
+    }
+}
+
+// a helper sleeps until there is a move it has not done, takes root moves until there are none left and sleeps again
+static void *searchHelper(void *argument) {
+    s_SearchThread *thread = argument;
+    s_SearchPool *pool = thread->pool;
+    uint32_t done = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->move == done && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        done = pool->move;
+        s_RootWork *work = pool->work;
+        pthread_mutex_unlock(&pool->lock);
+        searchRootMoves(work, thread->context);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// picks the placement for the current piece of the game, false if there is none at all
+bool findBestPlacement(s_Searcher *searcher, const s_GameState *game, s_Placement *best) {
+    s_Arena *arena = &searcher->contexts[0].arena;
+    s_Placement *placements = arenaAlloc(arena, MAX_PLACEMENTS * sizeof(*placements));
+    int count = generatePlacements(&game->board, &game->piece, placements, arena);
+    if (count == 0) {
+        resetArena(arena);
+        return false;
+    }
+
+    s_RootWork *work = arenaAlloc(arena, sizeof(*work));
+    work->board = &game->board;
+    work->hash = hashBoard(&game->board);
+    work->placements = placements;
+    work->count = count;
+    atomic_store(&work->nextPlacement, 0);
+
+    searcher->generation++;
+    for (int t = 0; t < searcher->threads; t++) {
+        s_SearchContext *context = &searcher->contexts[t];
+        context->generation = searcher->generation;
+        context->depth = searcher->depth;
+        context->pieces[0] = game->piece.type;
+        memcpy(context->pieces + 1, game->next, MAX_SEARCH_DEPTH - 1);
+    }
+    // the calling thread is the first search thread, the helpers are only woken when it is worth it
+    bool helped = searcher->helpers > 0 && count > 1;
+    s_SearchPool *pool = &searcher->pool;
+    if (helped) {
+        pthread_mutex_lock(&pool->lock);
+        pool->work = work;
+        pool->busy = searcher->helpers;
+        pool->move++;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    searchRootMoves(work, &searcher->contexts[0]);
+    if (helped) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->busy > 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    // a tie goes to the first of them, not to the thread that was done first
+    int bestIndex = 0;
+    for (int i = 1; i < count; i++) {
+        if (work->values[i] > work->values[bestIndex]) {
+            bestIndex = i;
+        }
+    }
+    *best = placements[bestIndex];
+    searcher->value = work->values[bestIndex];
+    resetArena(arena); // the move is made, all of it can go
+    return true;
+}
+
+/*
+ * Rendering: instead of clearing the terminal and printf'ing every cell each frame we keep the last frame we sent.
+ * A new frame is drawn into a character grid (border, board and the status lines below it), compared against the
+ * previous one, and only the runs of cells that changed are sent with a cursor positioning escape in front of them.
+ * Everything for one frame goes into a preallocated buffer and out with one write.
+ * The grid stays from one frame to the next and only the rows that can have changed are drawn and compared again,
+ * the dirty rows of the board plus the rows where the piece and its ghost are now or were in the last frame.
+ */
+#define STATUS_LINES 2
+#define STATUS_WIDTH 72
+#define SCREEN_WIDTH (BOARD_WIDTH + 2 > STATUS_WIDTH ? BOARD_WIDTH + 2 : STATUS_WIDTH)
+#define SCREEN_HEIGHT (BOARD_VISIBLE_ROWS + 2 + STATUS_LINES)
+#define RUN_GAP 8 // unchanged cells shorter than this are cheaper to resend than to jump over with a new escape
+#define RENDER_BUFFER_SIZE (SCREEN_HEIGHT * (SCREEN_WIDTH + 16) + 128) // the server puts a goodbye line after the last frame
+
+typedef struct {
+    int fd;
+    bool hasPrevious; // false until the first full frame was sent
+    uint64_t pieceRows; // board rows the piece and the ghost were drawn in last frame
+    char previous[SCREEN_HEIGHT][SCREEN_WIDTH];
+    char current[SCREEN_HEIGHT][SCREEN_WIDTH];
+    size_t length;
+    char out[RENDER_BUFFER_SIZE];
+} s_Renderer;
+
+void initRenderer(s_Renderer *renderer, int fd) {
+    renderer->fd = fd;
+    renderer->hasPrevious = false;
+    renderer->pieceRows = 0;
+    renderer->length = 0;
+}
+
+static void appendOutput(s_Renderer *renderer, const char *data, size_t length) {
+    memcpy(renderer->out + renderer->length, data, length);
+    renderer->length += length;
+}
+
+// ANSI rows and columns start at 1
+static void appendCursorMove(s_Renderer *renderer, int row, int column) {
+    renderer->length += snprintf(renderer->out + renderer->length, RENDER_BUFFER_SIZE - renderer->length,
+                                 "\033[%d;%dH", row + 1, column + 1);
+}
+
+// writes the whole buffer, stdin is non blocking and on a terminal it usually shares the file with stdout so we may get EAGAIN
+// without an fd the frame stays in the buffer, whoever owns the renderer sends it (that is what the server does)
+static void flushOutput(s_Renderer *renderer) {
+    if (renderer->fd < 0) {
+        return;
+    }
+    size_t sent = 0;
+    while (sent < renderer->length) {
+        ssize_t n = write(renderer->fd, renderer->out + sent, renderer->length - sent);
+        if (n > 0) {
+            sent += n;
+            countStat(COUNTER_TERMINAL_BYTES, n);
+        } else if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            struct pollfd pfd = { .fd = renderer->fd, .events = POLLOUT };
+            poll(&pfd, 1, -1);
+        } else {
+            LOG_ERROR("Error writing the frame: %s", strerror(errno));
+            break;
+        }
+    }
+    renderer->length = 0;
+}
+
+// puts a status line into the frame, padded with spaces so that a shorter line overwrites the old one
+static void drawStatusLine(s_Renderer *renderer, int line, const char *format, ...) {
+    char text[SCREEN_WIDTH + 1];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) {
+        length = 0;
+    } else if (length > SCREEN_WIDTH) {
+        length = SCREEN_WIDTH;
+    }
+    char *row = renderer->current[BOARD_VISIBLE_ROWS + 2 + line];
+    memcpy(row, text, length);
+    memset(row + length, ' ', SCREEN_WIDTH - length);
+}
+
+// the board rows the cells of a piece at y cover
+static inline uint64_t pieceRowMask(const s_TetrominoInfo *info, int y) {
+    int top = y + info->minY;
+    uint64_t rows = (1ull << (info->maxY - info->minY + 1)) - 1;
+    return top >= 0 ? rows << top : rows >> -top;
+}
+
+// draws board row y into its row of the frame
+static void drawBoardRow(s_Renderer *renderer, const s_Board *board, int y) {
+    char *row = renderer->current[y - BOARD_HIDDEN_ROWS + 1]; // the hidden rows are not drawn
+    row[0] = row[BOARD_WIDTH + 1] = '|';
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        row[x + 1] = (board->rows[y] & CELL_BIT(x)) ? FILLED_CELL : EMPTY_CELL;
+    }
+}
+
+// sends the changed runs of one row of the frame, close runs are merged so we don't pay for an escape every few cells
+static void diffScreenRow(s_Renderer *renderer, int y) {
+    const char *now = renderer->current[y];
+    const char *before = renderer->previous[y];
+    int x = 0;
+    while (x < SCREEN_WIDTH) {
+        if (now[x] == before[x]) {
+            x++;
+            continue;
+        }
+        int start = x;
+        int end = x; // last changed cell of the run
+        for (x++; x < SCREEN_WIDTH && x - end < RUN_GAP; x++) {
+            if (now[x] != before[x]) {
+                end = x;
+            }
+        }
+        appendCursorMove(renderer, y, start);
+        appendOutput(renderer, now + start, end - start + 1);
+        x = end + 1;
+    }
+}
+
+// now we need to add a function to display the game itself in the first place
+// dirtyRows are the board rows that changed since the last frame (see takeDirtyRows)
+void displayGame(s_Renderer *renderer, const s_GameState *game, uint64_t dirtyRows) {
+    uint64_t start = statsClock();
+    countStat(COUNTER_RENDERS, 1);
+    const s_Tetromino *tetromino = &game->piece;
+    char (*screen)[SCREEN_WIDTH] = renderer->current;
+    if (!renderer->hasPrevious) {
+        // the border first, top and bottom line and the two sides, it never changes after this
+        memset(renderer->current, ' ', sizeof(renderer->current));
+        screen[0][0] = screen[BOARD_VISIBLE_ROWS + 1][0] = '+';
+        screen[0][BOARD_WIDTH + 1] = screen[BOARD_VISIBLE_ROWS + 1][BOARD_WIDTH + 1] = '+';
+        memset(&screen[0][1], '-', BOARD_WIDTH);
+        memset(&screen[BOARD_VISIBLE_ROWS + 1][1], '-', BOARD_WIDTH);
+        dirtyRows = ALL_BOARD_ROWS;
+    }
+
+    // which rows the piece and the ghost are in now, those and the ones they were in before are drawn again
+    const s_TetrominoInfo *info = &TETROMINO_INFO[tetromino->type][tetromino->rotation];
+    int ghostY = landingRow(&game->board, tetromino);
+    uint64_t pieceRows = (pieceRowMask(info, tetromino->y) | pieceRowMask(info, ghostY)) & ALL_BOARD_ROWS;
+    uint64_t redraw = (dirtyRows | pieceRows | renderer->pieceRows) & VISIBLE_BOARD_ROWS;
+    renderer->pieceRows = pieceRows;
+
+    // now the board itself, this is the only place where the bits get turned back into characters
+    for (uint64_t rows = redraw; rows; rows &= rows - 1) {
+        drawBoardRow(renderer, &game->board, __builtin_ctzll(rows));
+    }
+
+    // now we add our tetromino on top of it, first the ghost where it would land and then the piece itself
+    for (int i = 0; i < 4; i++) {
+        int boardX = tetromino->x + info->cells[i][0];
+        int boardY = ghostY + info->cells[i][1];
+
+        if (boardX >= 0 && boardX < BOARD_WIDTH && boardY >= BOARD_HIDDEN_ROWS && boardY < BOARD_HEIGHT) {
+            screen[boardY - BOARD_HIDDEN_ROWS + 1][boardX + 1] = GHOST_CELL;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        int boardX = tetromino->x + info->cells[i][0];
+        int boardY = tetromino->y + info->cells[i][1];
+
+        if (boardX >= 0 && boardX < BOARD_WIDTH && boardY >= BOARD_HIDDEN_ROWS && boardY < BOARD_HEIGHT) {
+            screen[boardY - BOARD_HIDDEN_ROWS + 1][boardX + 1] = FILLED_CELL; // adding '#' for this
+        }
+    }
+
+    // we print the game info below the board
+    char next[NEXT_PIECES * 2];
+    for (int i = 0; i < NEXT_PIECES; i++) {
+        next[i * 2] = "IOTJLSZ"[game->next[i]];
+        next[i * 2 + 1] = i + 1 < NEXT_PIECES ? ' ' : '\0';
+    }
+    drawStatusLine(renderer, 0, "Score: %d Level: %d Lines: %d Next: %s", game->score, gameLevel(game), game->linesCleared, next);
+    // the arrows are the same as A/D/W/S, and all of it has to fit into STATUS_WIDTH
+    drawStatusLine(renderer, 1, "Keys (or arrows): A/D Move; W/Z Rotate; S Drop; Space Hard drop; Q Quit");
+    LOG_DEBUG("Tetromino position: x=%d, y=%d, type=%d, rotation=%d",
+                   tetromino->x, tetromino->y, tetromino->type, tetromino->rotation);
+
+    if (!renderer->hasPrevious) {
+        // very first frame, hide the cursor, clear the terminal and send everything
+        appendOutput(renderer, "\033[?25l\033[H\033[J", 13);
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            appendCursorMove(renderer, y, 0);
+            appendOutput(renderer, screen[y], SCREEN_WIDTH);
+        }
+        memcpy(renderer->previous, renderer->current, sizeof(renderer->previous));
+        renderer->hasPrevious = true;
+    } else {
+        // afterwards only the rows we drew and the status lines can be different
+        for (uint64_t rows = redraw; rows; rows &= rows - 1) {
+            int y = __builtin_ctzll(rows) - BOARD_HIDDEN_ROWS + 1;
+            diffScreenRow(renderer, y);
+            memcpy(renderer->previous[y], screen[y], SCREEN_WIDTH);
+        }
+        for (int y = BOARD_VISIBLE_ROWS + 2; y < SCREEN_HEIGHT; y++) {
+            diffScreenRow(renderer, y);
+            memcpy(renderer->previous[y], screen[y], SCREEN_WIDTH);
+        }
+    }
+
+    if (renderer->length > 0) {
+        // park the cursor below the frame so anything printed afterwards ends up there
+        appendCursorMove(renderer, SCREEN_HEIGHT, 0);
+        flushOutput(renderer);
+    }
+    recordTime(HISTOGRAM_FRAME, statsClock() - start);
+}
+
+// gives the terminal its cursor back once we are done drawing
+void closeRenderer(s_Renderer *renderer) {
+    appendOutput(renderer, "\033[?25h", 6);
+    flushOutput(renderer);
+}
+
+/*
+ * Replays, a game is its seed and the actions with the tick they happened on, the pieces and the gravity follow from
+ * those (the random numbers and the ticks are exactly the same every time), so that is all we store. The file is binary:
+ *     header  "TRPL", version, randomizer, piece count of the queue, board width, height and hidden rows,
+ *             seed (8 bytes little endian)
+ *     events  one varint each, (ticks since the last event << 3) | action
+ *     end     a varint with ACTION_END in the low 3 bits and the ticks up to the end of the game, then the final score
+ * and a file is as many of these as we like one after another. A headless game never moves the clock so most events are
+ * one byte, a game of a thousand pieces is a few kB. The whole game goes into a buffer and is written at the end in one
+ * write, so several threads can record into the same file.
+ */
+#define REPLAY_MAGIC "TRPL"
+#define REPLAY_VERSION 3 // 3 has the wall kicks, older replays would not play the same anymore
+#define REPLAY_HEADER_SIZE 18
+#define REPLAY_ACTION_BITS 3
+#define REPLAY_ACTION_MASK ((1u << REPLAY_ACTION_BITS) - 1)
+#define ACTION_END REPLAY_ACTION_MASK // not an action, marks the end of a game
+
+_Static_assert(NUM_OF_ACTIONS <= ACTION_END, "the actions have to fit into the replay action code");
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+    uint64_t lastTick;
+    bool failed; // we ran out of memory, the replay is dropped
+} s_ReplayWriter;
+
+static pthread_mutex_t replayLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void appendReplayByte(s_ReplayWriter *writer, uint8_t byte) {
+    if (writer->length == writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 4096;
+        uint8_t *data = realloc(writer->data, capacity);
+        if (!data) {
+            writer->failed = true;
+            return;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+    writer->data[writer->length++] = byte;
+}
+
+// 7 bits at a time starting from the lowest, the high bit says that another byte follows
+static void appendVarint(s_ReplayWriter *writer, uint64_t value) {
+    while (value >= 0x80) {
+        appendReplayByte(writer, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    appendReplayByte(writer, (uint8_t)value);
+}
+
+// returns false if the data ends in the middle of it or it is longer than 64 bits
+static bool readVarint(const uint8_t **cursor, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// starts a new game in the buffer, the buffer itself is kept from the game before
+void beginReplay(s_ReplayWriter *writer, const s_GameState *game) {
+    writer->length = 0;
+    writer->lastTick = game->tick;
+    writer->failed = false;
+    for (int i = 0; i < 4; i++) {
+        appendReplayByte(writer, REPLAY_MAGIC[i]);
+    }
+    appendReplayByte(writer, REPLAY_VERSION);
+    appendReplayByte(writer, (uint8_t)game->pieces.randomizer);
+    appendReplayByte(writer, NEXT_PIECES); // the queue draws pieces ahead, with another length the game is a different one
+    appendReplayByte(writer, BOARD_WIDTH); // and the same on another board, it has to be played by a build of that size
+    appendReplayByte(writer, BOARD_HEIGHT);
+    appendReplayByte(writer, BOARD_HIDDEN_ROWS);
+    for (int i = 0; i < 8; i++) {
+        appendReplayByte(writer, (uint8_t)(game->seed >> (8 * i)));
+    }
+}
+
+// call this right before the action goes into stepGame, with the game at the tick it happens on
+void recordAction(s_ReplayWriter *writer, const s_GameState *game, e_Action action) {
+    if (action == ACTION_NONE) {
+        return; // does nothing, so there is nothing to replay
+    }
+    appendVarint(writer, (game->tick - writer->lastTick) << REPLAY_ACTION_BITS | action);
+    writer->lastTick = game->tick;
+}
+
+// closes the game and writes it out, returns false if that did not work
+bool endReplay(s_ReplayWriter *writer, const s_GameState *game, int fd) {
+    appendVarint(writer, (game->tick - writer->lastTick) << REPLAY_ACTION_BITS | ACTION_END);
+    appendVarint(writer, (uint64_t)game->score);
+    if (writer->failed) {
+        LOG_ERROR("Out of memory recording the game with seed %llu", (unsigned long long)game->seed);
+        return false;
+    }
+    pthread_mutex_lock(&replayLock);
+    size_t sent = 0;
+    while (sent < writer->length) {
+        ssize_t n = write(fd, writer->data + sent, writer->length - sent);
+        if (n > 0) {
+            sent += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&replayLock);
+    if (sent < writer->length) {
+        LOG_ERROR("Error writing the replay: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static uint64_t loadLittle64(const uint8_t *data) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+void freeReplay(s_ReplayWriter *writer) {
+    free(writer->data);
+    writer->data = NULL;
+    writer->length = writer->capacity = 0;
+}
+
+/*
+ * Plays the next game of the data at cursor again, as fast as it goes. The game ends up exactly where the recorded one
+ * ended and expectedScore is the score it had then, if the two are not the same the game logic changed.
+ * Returns 1 for a game, 0 at the end of the data and -1 if the data is broken.
+ */
+int replayGame(const uint8_t **cursor, const uint8_t *end, s_GameState *game, int *expectedScore) {
+    const uint8_t *data = *cursor;
+    if (data == end) {
+        return 0;
+    }
+    if (end - data < REPLAY_HEADER_SIZE || memcmp(data, REPLAY_MAGIC, 4) != 0 || data[4] != REPLAY_VERSION ||
+        data[5] > RANDOMIZER_BAG || data[6] != NEXT_PIECES || data[7] != BOARD_WIDTH || data[8] != BOARD_HEIGHT ||
+        data[9] != BOARD_HIDDEN_ROWS) {
+        return -1;
+    }
+    initGame(game, loadLittle64(data + 10), (e_Randomizer)data[5]);
+    *cursor = data + REPLAY_HEADER_SIZE;
+    uint64_t event;
+    while (readVarint(cursor, end, &event)) {
+        advanceGame(game, event >> REPLAY_ACTION_BITS);
+        unsigned action = event & REPLAY_ACTION_MASK;
+        if (action == ACTION_END) {
+            uint64_t score;
+            if (!readVarint(cursor, end, &score)) {
+                return -1;
+            }
+            *expectedScore = (int)score;
+            return 1;
+        }
+        if (action >= NUM_OF_ACTIONS) {
+            return -1;
+        }
+        stepGame(game, (e_Action)action);
+    }
+    return -1;
+}
+
+// moves the cursor over the next game without playing it, returns false if the data is broken
+static bool skipReplay(const uint8_t **cursor, const uint8_t *end) {
+    if (end - *cursor < REPLAY_HEADER_SIZE || memcmp(*cursor, REPLAY_MAGIC, 4) != 0) {
+        return false;
+    }
+    *cursor += REPLAY_HEADER_SIZE;
+    uint64_t event;
+    while (readVarint(cursor, end, &event)) {
+        if ((event & REPLAY_ACTION_MASK) == ACTION_END) {
+            return readVarint(cursor, end, &event);
+        }
+    }
+    return false;
+}
+
+/*
+ * A corpus is a replay file with an index in front, so it can be split up without reading it first:
+ *     "TRPX", version, 3 bytes zero, the number of games (8 bytes), then games + 1 byte offsets (8 bytes each)
+ * all little endian, game i starts at offsets[i] (from the start of the file) and ends at offsets[i + 1] where the
+ * next one starts. After the index the games follow exactly like in a plain replay file. --index makes one from a plain
+ * file (or a few of them put together with cat, because those are just games one after another).
+ */
+#define CORPUS_MAGIC "TRPX"
+#define CORPUS_VERSION 1
+#define CORPUS_HEADER_SIZE 16
+
+typedef struct {
+    const uint8_t *data; // the whole file, mapped
+    size_t length;
+    bool indexed; // false for a plain replay file
+    uint64_t games; // in the index, an index can have none
+    const uint8_t *offsets;
+} s_ReplayCorpus;
+
+// maps the file, it can be a plain replay file or a corpus, returns false if it can not be used
+bool openReplayCorpus(s_ReplayCorpus *corpus, const char *path) {
+    memset(corpus, 0, sizeof(*corpus));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the replay file %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        LOG_ERROR("Could not stat the replay file %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    corpus->length = (size_t)info.st_size;
+    if (corpus->length > 0) {
+        void *data = mmap(NULL, corpus->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            LOG_ERROR("Could not map the replay file %s: %s", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        corpus->data = data;
+        madvise(data, corpus->length, MADV_SEQUENTIAL); // every game is read once from the front, the kernel can read ahead
+    }
+    close(fd); // the mapping stays without it
+    if (corpus->length < CORPUS_HEADER_SIZE || memcmp(corpus->data, CORPUS_MAGIC, 4) != 0) {
+        return true; // a plain replay file, it is played from the front to the back
+    }
+    corpus->indexed = true;
+    corpus->games = loadLittle64(corpus->data + 8);
+    corpus->offsets = corpus->data + CORPUS_HEADER_SIZE;
+    uint64_t indexEnd = CORPUS_HEADER_SIZE + (corpus->games + 1) * 8;
+    bool valid = corpus->data[4] == CORPUS_VERSION && corpus->games < corpus->length / 8 && indexEnd <= corpus->length;
+    for (uint64_t i = 0; valid && i <= corpus->games; i++) {
+        uint64_t offset = loadLittle64(corpus->offsets + 8 * i);
+        valid = offset >= indexEnd && offset <= corpus->length &&
+                (i == 0 || offset >= loadLittle64(corpus->offsets + 8 * (i - 1)));
+    }
+    if (!valid) {
+        LOG_ERROR("The index of the replay corpus %s is broken", path);
+        munmap((void *)corpus->data, corpus->length);
+        return false;
+    }
+    return true;
+}
+
+void closeReplayCorpus(s_ReplayCorpus *corpus) {
+    if (corpus->data) {
+        munmap((void *)corpus->data, corpus->length);
+    }
+    corpus->data = NULL;
+}
+
+// the games first up to first + count - 1 of an indexed corpus are the bytes from begin to end
+void corpusRange(const s_ReplayCorpus *corpus, uint64_t first, uint64_t count, const uint8_t **begin, const uint8_t **end) {
+    *begin = corpus->data + loadLittle64(corpus->offsets + 8 * first);
+    *end = corpus->data + loadLittle64(corpus->offsets + 8 * (first + count));
+}
+
+// writes the plain replay file at input as a corpus with an index to output
+int indexReplays(const char *input, const char *output) {
+    s_ReplayCorpus corpus;
+    if (!openReplayCorpus(&corpus, input)) {
+        return EXIT_FAILURE;
+    }
+    if (corpus.indexed) {
+        LOG_ERROR("%s already has an index", input);
+        closeReplayCorpus(&corpus);
+        return EXIT_FAILURE;
+    }
+    // once over the file to count the games, then the offsets are known before anything is written
+    uint64_t games = 0;
+    const uint8_t *cursor = corpus.data;
+    const uint8_t *end = corpus.data + corpus.length;
+    while (cursor < end) {
+        if (!skipReplay(&cursor, end)) {
+            LOG_ERROR("The replay file %s is broken at byte %zu", input, (size_t)(cursor - corpus.data));
+            closeReplayCorpus(&corpus);
+            return EXIT_FAILURE;
+        }
+        games++;
+    }
+    size_t headerLength = CORPUS_HEADER_SIZE + (games + 1) * 8;
+    uint8_t *header = malloc(headerLength);
+    if (!header) {
+        LOG_ERROR("Error allocating the index: %s", strerror(errno));
+        closeReplayCorpus(&corpus);
+        return EXIT_FAILURE;
+    }
+    memset(header, 0, CORPUS_HEADER_SIZE);
+    memcpy(header, CORPUS_MAGIC, 4);
+    header[4] = CORPUS_VERSION;
+    for (int i = 0; i < 8; i++) {
+        header[8 + i] = (uint8_t)(games >> (8 * i));
+    }
+    cursor = corpus.data;
+    for (uint64_t game = 0; game <= games; game++) {
+        uint64_t offset = headerLength + (uint64_t)(cursor - corpus.data);
+        for (int i = 0; i < 8; i++) {
+            header[CORPUS_HEADER_SIZE + 8 * game + i] = (uint8_t)(offset >> (8 * i));
+        }
+        if (game < games) {
+            skipReplay(&cursor, end);
+        }
+    }
+
+    int status = EXIT_FAILURE;
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the corpus file %s: %s", output, strerror(errno));
+    } else {
+        const uint8_t *parts[2] = { header, corpus.data };
+        size_t lengths[2] = { headerLength, corpus.length };
+        status = 0;
+        for (int part = 0; part < 2 && status == 0; part++) {
+            size_t sent = 0;
+            while (sent < lengths[part]) {
+                ssize_t n = write(fd, parts[part] + sent, lengths[part] - sent);
+                if (n > 0) {
+                    sent += n;
+                } else if (!(n == -1 && errno == EINTR)) {
+                    LOG_ERROR("Error writing the corpus file %s: %s", output, strerror(errno));
+                    status = EXIT_FAILURE;
+                    break;
+                }
+            }
+        }
+        close(fd);
+    }
+    if (status == 0) {
+        printf("%llu games indexed into %s\n", (unsigned long long)games, output);
+    }
+    free(header);
+    closeReplayCorpus(&corpus);
+    return status;
+}
+
+/*
+ * Headless mode, no terminal and no drawing, just the game logic as fast as it goes.
+ * The input either comes from a script (a string of the same keys you would press, a/d/w/s, repeated over and over)
+ * or if there is no script from random actions.
+ */
+#define HEADLESS_MAX_STEPS 1000000 // a script that never drops (or a bot that never loses) would otherwise never end
+
+typedef struct {
+    int games;
+    long long score;
+    long long linesCleared;
+    long long piecesPlaced;
+    long long steps;
+} s_HeadlessResult;
+
+e_Action actionForKey(char key) {
+    switch (key) {
+        case 'a': return ACTION_LEFT;
+        case 'd': return ACTION_RIGHT;
+        case 'w': return ACTION_ROTATE;
+        case 'z': return ACTION_ROTATE_BACK;
+        case 's': return ACTION_SOFT_DROP;
+        case ' ': return ACTION_HARD_DROP;
+        default: return ACTION_NONE;
+    }
+}
+
+/*
+ * Holding a key to move, with a delayed auto shift (DAS) and an auto repeat rate (ARR) of our own. A terminal never
+ * tells us that a key was let go, all we get are the bytes of the presses and of its own autorepeat, which is slow to
+ * start and different on every machine. So a key counts as held once two of its bytes come in less than
+ * KEY_REPEAT_GAP apart and as let go when its repeats stop. While it is held the piece moves on our clock: DAS ticks
+ * after the press and then every ARR ticks, and with an ARR of 0 it slides to the wall at once (and again whenever the
+ * piece moved down or turned). The moves are played and recorded like keys, replays don't need any of this.
+ */
+#define KEY_REPEAT_GAP 100 // ms, every terminal autorepeats faster than this
+#define KEY_FIRST_REPEAT 700 // ms, and its first repeat comes at most this long after the press
+#define DEFAULT_DAS 167 // ms, 10 and 2 frames at 60 Hz like most other tetrises
+#define DEFAULT_ARR 33
+
+typedef struct {
+    int das; // ticks
+    int arr; // ticks, 0 slides the piece to the wall
+    int8_t direction; // of the last left or right key, -1 left and 1 right
+    bool held;
+    uint64_t pressTick; // game tick the key went down
+    uint64_t lastKeyTick; // game tick its last byte came in
+    uint64_t repeatGap; // between its last two bytes, the key is let go once the next one is late
+    uint64_t nextShiftTick;
+} s_AutoShift;
+
+void initAutoShift(s_AutoShift *shift, int das, int arr) {
+    memset(shift, 0, sizeof(*shift));
+    shift->das = das;
+    shift->arr = arr;
+}
+
+// the next game tick the auto shift has something to do on, UINT64_MAX while no key is held
+static inline uint64_t autoShiftDueTick(const s_AutoShift *shift) {
+    if (!shift->held) {
+        return UINT64_MAX;
+    }
+    uint64_t release = shift->lastKeyTick + shift->repeatGap * 3 / 2 + 1;
+    return shift->nextShiftTick < release ? shift->nextShiftTick : release;
+}
+
+// a key came in on game tick, returns what the key itself does, the moves of a held key are up to the auto shift
+e_Action autoShiftKey(s_AutoShift *shift, char key, uint64_t tick) {
+    e_Action action = actionForKey(key);
+    int direction = action == ACTION_LEFT ? -1 : action == ACTION_RIGHT ? 1 : 0;
+    if (direction == 0) {
+        if (shift->held && shift->arr == 0) {
+            shift->nextShiftTick = tick; // the piece is somewhere else now, it slides again
+        }
+        return action;
+    }
+    uint64_t gap = tick - shift->lastKeyTick;
+    bool same = direction == shift->direction;
+    shift->lastKeyTick = tick;
+    if (same && gap <= KEY_REPEAT_GAP) {
+        shift->repeatGap = gap;
+        if (shift->held) {
+            return ACTION_NONE; // the terminal repeats it, but we move it on our own clock
+        }
+        // now we know it is held, this byte still moves like the ones before it did
+        shift->held = true;
+        uint64_t shiftTick = shift->pressTick + shift->das;
+        shift->nextShiftTick = shiftTick > tick + shift->arr ? shiftTick : tick + shift->arr;
+        return action;
+    }
+    // a press, or the first repeat of one (that is the same as the terminal would do), it moves once
+    if (!same || gap > KEY_FIRST_REPEAT) {
+        shift->pressTick = tick;
+    }
+    shift->direction = (int8_t)direction;
+    shift->held = false;
+    return action;
+}
+
+// lets the game run up to tick with the moves of a held key on the ticks they are due, replay records them if it is set
+void advanceAutoShift(s_AutoShift *shift, s_GameState *game, uint64_t tick, s_ReplayWriter *replay) {
+    for (uint64_t due = autoShiftDueTick(shift); due <= tick && !game->gameOver; due = autoShiftDueTick(shift)) {
+        if (due > game->tick) {
+            advanceGame(game, due - game->tick);
+        }
+        if (due != shift->nextShiftTick) {
+            shift->held = false; // no repeat came, the key is up
+            break;
+        }
+        e_Action action = shift->direction < 0 ? ACTION_LEFT : ACTION_RIGHT;
+        int moves;
+        if (shift->arr > 0) {
+            int x = game->piece.x;
+            stepGame(game, action);
+            moves = game->piece.x != x;
+            shift->nextShiftTick += shift->arr;
+        } else {
+            moves = slideTetromino(&game->board, &game->piece, shift->direction);
+            shift->nextShiftTick = nextDropTick(game); // at the wall, but after the next drop there may be more room
+        }
+        for (int i = 0; replay && i < moves; i++) {
+            recordAction(replay, game, action);
+        }
+    }
+    if (tick > game->tick) {
+        advanceGame(game, tick - game->tick);
+    }
+}
+
+// what main is going to do
+typedef enum {
+    MODE_INTERACTIVE,
+    MODE_HEADLESS,
+    MODE_BENCH,
+    MODE_REPLAY,
+    MODE_INDEX,
+    MODE_SERVER,
+    MODE_WATCH,
+    MODE_MERGE
+} e_Mode;
+
+// everything the command line can change
+typedef struct {
+    e_Mode mode;
+    int games;
+    int threads;
+    const char *script;
+    uint64_t seed;
+    e_Randomizer randomizer;
+    long long maxSteps; // a game stops after this many steps (placements for the bot)
+    bool bot; // the headless games are played by the search instead of random keys
+    int searchDepth;
+    int searchThreads;
+    int recordFd; // every game is recorded into this file, -1 if not
+    int resultsFd; // every game that ends goes into this file as a record, -1 if not
+    const char *mergeOutput; // --merge writes the results files into this one
+    char **mergeInputs;
+    int mergeCount;
+    const char *replay; // the file --replay plays back
+    const char *indexOutput; // --index writes the replay file as an indexed corpus to this
+    const char *save; // quitting the game with q saves it to this file
+    const char *load; // the game goes on from this save instead of starting new
+    int port; // the server listens on this, --watch connects to it
+    int spectatePort; // the server takes spectators on this, 0 if it does not
+    const char *watchHost; // the server --watch connects to
+    int watchGame; // the number of the game --watch asks for, -1 for the oldest one
+    int das; // ms a held left or right key waits before it repeats
+    int arr; // ms between its repeats, 0 slides to the wall
+    bool stats; // the counters and histograms are dumped at exit
+} s_Options;
+
+/*
+ * Game results, one fixed size binary record for every game that was played, for looking at millions of games at a
+ * time (how a change to the randomizer or the scoring plays out) where text would be far too big and slow. A results
+ * file is a header and then the records as they are in memory, so a reader can map it and take the records as an array
+ * (NumPy with a structured dtype), the header has the record size and the byte order so nothing is read wrong.
+ * Every headless worker (and the server) collects its records in its own buffer and writes a whole batch at once, so
+ * the threads only meet at the lock around that one write and the order of the records is the order the batches came
+ * in, the seed of every game is in its record. --merge puts the files of several runs (or machines) into one and adds
+ * them all up while it streams through them.
+ */
+#define RESULTS_MAGIC "TRES"
+#define RESULTS_VERSION 1
+#define RESULTS_BATCH 1024 // records a writer collects before they go out
+#define RESULTS_FLUSH_MICROS 1000000 // the server has games end now and then, it writes what it has at least this often
+#define RESULTS_CHUNK (1 << 20) // bytes --merge reads at a time
+
+// where the game was played
+typedef enum {
+    RESULT_KEYS, // headless with a script or random keys
+    RESULT_BOT, // headless by the search
+    RESULT_SERVER // by a player on the server
+} e_ResultSource;
+
+typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t width;
+    uint8_t height;
+    uint8_t nextPieces;
+    uint32_t recordSize;
+    uint32_t byteOrder;
+} s_ResultsHeader;
+
+// the fields are ordered so there are no holes, 72 bytes
+typedef struct {
+    uint64_t seed;
+    uint64_t micros; // how long the game took, the time it was played on the server, the time it took headless
+    uint64_t steps; // keys (or placements of the bot) it took
+    int32_t score;
+    uint32_t level;
+    uint32_t linesCleared;
+    uint32_t piecesPlaced;
+    uint32_t pieceCounts[NUM_OF_SHAPES];
+    uint8_t maxHeight;
+    uint8_t randomizer; // an e_Randomizer
+    uint8_t source; // an e_ResultSource
+    uint8_t reserved;
+} s_GameRecord;
+
+_Static_assert(sizeof(s_GameRecord) == 72, "the records are written as they are");
+
+typedef struct {
+    int fd;
+    int count;
+    s_GameRecord *records; // RESULTS_BATCH of them
+} s_ResultWriter;
+
+static pthread_mutex_t resultsLock = PTHREAD_MUTEX_INITIALIZER; // the headless workers share the file
+
+static void initResultsHeader(s_ResultsHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, RESULTS_MAGIC, 4);
+    header->version = RESULTS_VERSION;
+    header->width = BOARD_WIDTH;
+    header->height = BOARD_HEIGHT;
+    header->nextPieces = NEXT_PIECES;
+    header->recordSize = sizeof(s_GameRecord);
+    header->byteOrder = SAVE_BYTE_ORDER;
+}
+
+// keeps writing until all of it is out, false if that does not work
+static bool writeAll(int fd, const void *data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = write(fd, (const uint8_t *)data + sent, length - sent);
+        if (n > 0) {
+            sent += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// opens a new results file with its header, -1 if that does not work
+int createResults(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the results file %s: %s", path, strerror(errno));
+        return -1;
+    }
+    s_ResultsHeader header;
+    initResultsHeader(&header);
+    if (!writeAll(fd, &header, sizeof(header))) {
+        LOG_ERROR("Error writing the results file %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool initResultWriter(s_ResultWriter *writer, int fd) {
+    writer->fd = fd;
+    writer->count = 0;
+    writer->records = malloc(RESULTS_BATCH * sizeof(s_GameRecord));
+    return writer->records != NULL;
+}
+
+bool flushResults(s_ResultWriter *writer) {
+    pthread_mutex_lock(&resultsLock);
+    bool written = writeAll(writer->fd, writer->records, writer->count * sizeof(s_GameRecord));
+    pthread_mutex_unlock(&resultsLock);
+    if (!written) {
+        LOG_ERROR("Error writing %d results: %s", writer->count, strerror(errno));
+    }
+    writer->count = 0;
+    return written;
+}
+
+/*
+ * What a record has on top of the game itself: the pieces of every type and the highest the stack got, kept next to
+ * the game by whoever plays it (the headless runner, a server session) so the game state stays small for everybody
+ * else. It is brought up to date after every step, the pieces locked since the last time are the current and next
+ * ones from then, and the stack height is the highest column after the lock (and its cleared lines).
+ * A step locks one piece at most and even a long catch up of a session only a few, never more than were shown.
+ */
+typedef struct {
+    int piecesSeen; // piecesPlaced of the game the last time
+    uint8_t upcoming[NEXT_PIECES + 1]; // the current piece and the next ones of that time
+    uint8_t maxHeight;
+    uint32_t pieceCounts[NUM_OF_SHAPES];
+} s_GameStats;
+
+static void noteUpcoming(s_GameStats *stats, const s_GameState *game) {
+    stats->piecesSeen = game->piecesPlaced;
+    stats->upcoming[0] = game->piece.type;
+    memcpy(stats->upcoming + 1, game->next, NEXT_PIECES);
+}
+
+void initGameStats(s_GameStats *stats, const s_GameState *game) {
+    memset(stats, 0, sizeof(*stats));
+    noteUpcoming(stats, game);
+}
+
+void updateGameStats(s_GameStats *stats, const s_GameState *game) {
+    int locked = game->piecesPlaced - stats->piecesSeen;
+    if (locked == 0) {
+        return;
+    }
+    for (int i = 0; i < locked && i <= NEXT_PIECES; i++) {
+        stats->pieceCounts[stats->upcoming[i]]++;
+    }
+    for (int x = 0; x < BOARD_WIDTH; x++) {
+        stats->maxHeight = game->board.heights[x] > stats->maxHeight ? game->board.heights[x] : stats->maxHeight;
+    }
+    noteUpcoming(stats, game);
+}
+
+void addResult(s_ResultWriter *writer, const s_GameState *game, const s_GameStats *stats, uint64_t micros,
+               uint64_t steps, e_ResultSource source) {
+    s_GameRecord *record = &writer->records[writer->count];
+    memset(record, 0, sizeof(*record));
+    record->seed = game->seed;
+    record->micros = micros;
+    record->steps = steps;
+    record->score = game->score;
+    record->level = gameLevel(game);
+    record->linesCleared = game->linesCleared;
+    record->piecesPlaced = game->piecesPlaced;
+    memcpy(record->pieceCounts, stats->pieceCounts, sizeof(record->pieceCounts));
+    record->maxHeight = stats->maxHeight;
+    record->randomizer = game->pieces.randomizer;
+    record->source = source;
+    if (++writer->count == RESULTS_BATCH) {
+        flushResults(writer);
+    }
+}
+
+// the ones that are left go out
+void closeResultWriter(s_ResultWriter *writer) {
+    if (writer->count > 0) {
+        flushResults(writer);
+    }
+    free(writer->records);
+    writer->records = NULL;
+}
+
+// everything --merge adds up
+typedef struct {
+    uint64_t games;
+    int64_t score;
+    int32_t bestScore;
+    uint64_t linesCleared;
+    uint64_t piecesPlaced;
+    uint64_t maxHeight;
+    uint64_t micros;
+    uint64_t pieceCounts[NUM_OF_SHAPES];
+    uint64_t sources[RESULT_SERVER + 1];
+} s_ResultTotals;
+
+static void addTotals(s_ResultTotals *totals, const s_GameRecord *records, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const s_GameRecord *record = &records[i];
+        totals->games++;
+        totals->score += record->score;
+        totals->bestScore = record->score > totals->bestScore ? record->score : totals->bestScore;
+        totals->linesCleared += record->linesCleared;
+        totals->piecesPlaced += record->piecesPlaced;
+        totals->maxHeight += record->maxHeight;
+        totals->micros += record->micros;
+        for (int t = 0; t < NUM_OF_SHAPES; t++) {
+            totals->pieceCounts[t] += record->pieceCounts[t];
+        }
+        totals->sources[record->source <= RESULT_SERVER ? record->source : RESULT_KEYS]++;
+    }
+}
+
+// streams one results file into the merged one, a chunk at a time so no file is ever in memory as a whole
+static bool mergeResultsFile(const char *path, int out, s_GameRecord *chunk, s_ResultTotals *totals) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open the results file %s: %s", path, strerror(errno));
+        return false;
+    }
+    s_ResultsHeader header, expected;
+    initResultsHeader(&expected);
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || memcmp(&header, &expected, sizeof(header)) != 0) {
+        LOG_ERROR("%s is not a results file of this build", path);
+        close(fd);
+        return false;
+    }
+    size_t have = 0; // bytes of a record that was cut at the end of the last read
+    bool ok = true;
+    for (;;) {
+        ssize_t n = read(fd, (uint8_t *)chunk + have, RESULTS_CHUNK - have);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0 && have == 0;
+            if (!ok) {
+                LOG_ERROR("%s: %s", path, n < 0 ? strerror(errno) : "the last record is cut off");
+            }
+            break;
+        }
+        have += n;
+        size_t records = have / sizeof(s_GameRecord);
+        addTotals(totals, chunk, records);
+        if (!writeAll(out, chunk, records * sizeof(s_GameRecord))) {
+            LOG_ERROR("Error writing the merged results: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+        have -= records * sizeof(s_GameRecord);
+        memmove(chunk, (uint8_t *)chunk + records * sizeof(s_GameRecord), have);
+    }
+    close(fd);
+    return ok;
+}
+
+int mergeResults(const char *output, char **inputs, int count) {
+    int out = createResults(output);
+    if (out < 0) {
+        return EXIT_FAILURE;
+    }
+    s_GameRecord *chunk = malloc(RESULTS_CHUNK);
+    if (!chunk) {
+        LOG_ERROR("Error allocating the merge buffer");
+        close(out);
+        return EXIT_FAILURE;
+    }
+    s_ResultTotals totals;
+    memset(&totals, 0, sizeof(totals));
+    int broken = 0;
+    for (int i = 0; i < count; i++) {
+        broken += !mergeResultsFile(inputs[i], out, chunk, &totals);
+    }
+    free(chunk);
+    if (close(out) != 0) {
+        LOG_ERROR("Error writing the merged results: %s", strerror(errno));
+        broken++;
+    }
+
+    double games = totals.games ? (double)totals.games : 1.0;
+    printf("files: %d (%d broken)\n", count, broken);
+    printf("games: %llu (%llu keys, %llu bot, %llu server)\n", (unsigned long long)totals.games,
+           (unsigned long long)totals.sources[RESULT_KEYS], (unsigned long long)totals.sources[RESULT_BOT],
+           (unsigned long long)totals.sources[RESULT_SERVER]);
+    printf("average score: %.2f (best %d)\n", totals.score / games, totals.bestScore);
+    printf("average lines: %.2f\n", totals.linesCleared / games);
+    printf("average pieces: %.2f\n", totals.piecesPlaced / games);
+    printf("average max height: %.2f\n", totals.maxHeight / games);
+    printf("average time: %.3f s\n", totals.micros / games / 1e6);
+    printf("pieces:");
+    for (int t = 0; t < NUM_OF_SHAPES; t++) {
+        printf(" %c %.2f%%", "IOTJLSZ"[t],
+               totals.piecesPlaced ? 100.0 * totals.pieceCounts[t] / totals.piecesPlaced : 0.0);
+    }
+    printf("\n");
+    return broken > 0 ? EXIT_FAILURE : 0;
+}
+
+// plays the games first up to first + count - 1, game number i is seeded with seed + i
+void runHeadless(const s_Options *options, int first, int count, s_HeadlessResult *result) {
+    memset(result, 0, sizeof(*result));
+    const char *script = options->script;
+    size_t scriptLength = script ? strlen(script) : 0;
+    s_Searcher *searcher = NULL;
+    if (options->bot) {
+        searcher = createSearcher(options->searchDepth, options->searchThreads);
+        if (!searcher) {
+            LOG_ERROR("Error allocating the search tables");
+            return;
+        }
+    }
+    s_ReplayWriter replay = { 0 };
+    s_ResultWriter results = { .fd = -1 };
+    if (options->resultsFd >= 0 && !initResultWriter(&results, options->resultsFd)) {
+        LOG_ERROR("Error allocating the results buffer");
+        destroySearcher(searcher);
+        return;
+    }
+    for (int i = first; i < first + count; i++) {
+        uint64_t started = monotonicMicros();
+        s_GameState game;
+        initGame(&game, options->seed + i, options->randomizer);
+        s_GameStats stats;
+        initGameStats(&stats, &game);
+        if (options->recordFd >= 0) {
+            beginReplay(&replay, &game);
+        }
+        // the random actions get their own stream next to the one of the pieces
+        s_Random actions;
+        seedRandom(&actions, ~(options->seed + i));
+        long long steps = 0;
+        while (!game.gameOver && steps < options->maxSteps) {
+            if (searcher) {
+                s_Placement placement;
+                if (!findBestPlacement(searcher, &game, &placement)) {
+                    break;
+                }
+                applyPlacement(&game, &placement);
+            } else {
+                e_Action action;
+                if (scriptLength > 0) {
+                    action = actionForKey(script[steps % scriptLength]);
+                } else {
+                    action = ACTION_LEFT + randomBelow(&actions, NUM_OF_ACTIONS - ACTION_LEFT);
+                }
+                if (options->recordFd >= 0) {
+                    recordAction(&replay, &game, action);
+                }
+                stepGame(&game, action);
+            }
+            updateGameStats(&stats, &game);
+            steps++;
+        }
+        if (options->recordFd >= 0) {
+            endReplay(&replay, &game, options->recordFd);
+        }
+        if (results.fd >= 0) {
+            addResult(&results, &game, &stats, monotonicMicros() - started, steps, searcher ? RESULT_BOT : RESULT_KEYS);
+        }
+        result->games++;
+        result->score += game.score;
+        result->linesCleared += game.linesCleared;
+        result->piecesPlaced += game.piecesPlaced;
+        result->steps += steps;
+    }
+    freeReplay(&replay);
+    if (results.fd >= 0) {
+        closeResultWriter(&results);
+    }
+    destroySearcher(searcher);
+}
+
+/*
+ * The game farm, the games are split evenly over a number of threads and every thread plays its share on its own
+ * games with its own seeds. Nothing is shared while they run, every worker only writes its own slot (one cache line
+ * or more each so they don't fight over it) and the totals are added up after all of them are joined.
+ */
+typedef struct {
+    _Alignas(64) pthread_t thread;
+    const s_Options *options;
+    int first;
+    int games;
+    double seconds;
+    s_HeadlessResult result;
+} s_FarmWorker;
+
+static void *farmWorker(void *argument) {
+    s_FarmWorker *worker = argument;
+    uint64_t start = monotonicMicros();
+    runHeadless(worker->options, worker->first, worker->games, &worker->result);
+    worker->seconds = (monotonicMicros() - start) / 1e6;
+    return NULL;
+}
+
+int playHeadless(const s_Options *options) {
+    int games = options->games;
+    int threads = options->threads;
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > games && games > 0) {
+        threads = games;
+    }
+    s_FarmWorker *workers = aligned_alloc(_Alignof(s_FarmWorker), threads * sizeof(s_FarmWorker));
+    if (!workers) {
+        LOG_ERROR("Error allocating the workers: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = monotonicMicros();
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        s_FarmWorker *worker = &workers[i];
+        memset(worker, 0, sizeof(*worker));
+        // games i * games / threads up to (i + 1) * games / threads belong to this worker
+        worker->options = options;
+        worker->first = (int)((long long)games * i / threads);
+        worker->games = (int)((long long)games * (i + 1) / threads) - worker->first;
+        int error = pthread_create(&worker->thread, NULL, farmWorker, worker);
+        if (error != 0) {
+            LOG_ERROR("Error starting a worker thread: %s", strerror(error));
+            break;
+        }
+        started++;
+    }
+
+    s_HeadlessResult total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        total.games += workers[i].result.games;
+        total.score += workers[i].result.score;
+        total.linesCleared += workers[i].result.linesCleared;
+        total.piecesPlaced += workers[i].result.piecesPlaced;
+        total.steps += workers[i].result.steps;
+    }
+    double seconds = (monotonicMicros() - start) / 1e6;
+
+    for (int i = 0; i < started; i++) {
+        const s_FarmWorker *worker = &workers[i];
+        double perSecond = worker->seconds > 0 ? 1.0 / worker->seconds : 0.0;
+        printf("thread %d: %d games, %.0f games/s, %.0f placements/s\n", i, worker->result.games,
+               worker->result.games * perSecond, worker->result.piecesPlaced * perSecond);
+    }
+    printf("seed: %llu\n", (unsigned long long)options->seed);
+    printf("games: %d\n", total.games);
+    printf("steps: %lld\n", total.steps);
+    printf("pieces placed: %lld\n", total.piecesPlaced);
+    printf("lines cleared: %lld\n", total.linesCleared);
+    printf("average score: %.2f\n", total.games ? (double)total.score / total.games : 0.0);
+    printf("time: %.3f s (%.0f games/s, %.0f placements/s)\n", seconds, seconds > 0 ? total.games / seconds : 0.0,
+           seconds > 0 ? total.piecesPlaced / seconds : 0.0);
+
+    free(workers);
+    return started == threads ? 0 : EXIT_FAILURE;
+}
+
+/*
+ * Playing replays back, every worker gets its own range of the mapped file and plays the games in it straight from
+ * there, nothing is copied. A corpus is split by its index like the headless games are, a plain file has no index so
+ * it all goes to one worker.
+ */
+typedef struct {
+    _Alignas(64) pthread_t thread;
+    const uint8_t *begin;
+    const uint8_t *end;
+    const uint8_t *cursor; // where it stopped, the end unless the data is broken
+    int status;
+    int mismatches;
+    double seconds;
+    s_HeadlessResult result;
+} s_ReplayWorker;
+
+static void *replayWorker(void *argument) {
+    s_ReplayWorker *worker = argument;
+    uint64_t start = monotonicMicros();
+    worker->cursor = worker->begin;
+    s_GameState game;
+    int expectedScore;
+    while ((worker->status = replayGame(&worker->cursor, worker->end, &game, &expectedScore)) == 1) {
+        if (game.score != expectedScore) {
+            printf("seed %llu: score %d, recorded %d\n", (unsigned long long)game.seed, game.score, expectedScore);
+            worker->mismatches++;
+        }
+        worker->result.games++;
+        worker->result.score += game.score;
+        worker->result.linesCleared += game.linesCleared;
+        worker->result.piecesPlaced += game.piecesPlaced;
+    }
+    worker->seconds = (monotonicMicros() - start) / 1e6;
+    return NULL;
+}
+
+// plays every game of a replay file again and checks that it still ends with the score it was recorded with
+int playReplays(const s_Options *options) {
+    s_ReplayCorpus corpus;
+    if (!openReplayCorpus(&corpus, options->replay)) {
+        return EXIT_FAILURE;
+    }
+    int threads = options->threads < 1 ? 1 : options->threads;
+    if (!corpus.indexed) {
+        threads = 1;
+    } else if ((uint64_t)threads > corpus.games) {
+        threads = corpus.games > 0 ? (int)corpus.games : 1; // the one for an empty index just plays nothing
+    }
+    s_ReplayWorker *workers = aligned_alloc(_Alignof(s_ReplayWorker), threads * sizeof(s_ReplayWorker));
+    if (!workers) {
+        LOG_ERROR("Error allocating the workers: %s", strerror(errno));
+        closeReplayCorpus(&corpus);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = monotonicMicros();
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        s_ReplayWorker *worker = &workers[i];
+        memset(worker, 0, sizeof(*worker));
+        if (!corpus.indexed) {
+            worker->begin = corpus.data;
+            worker->end = corpus.data + corpus.length;
+        } else {
+            uint64_t first = corpus.games * i / threads;
+            corpusRange(&corpus, first, corpus.games * (i + 1) / threads - first, &worker->begin, &worker->end);
+        }
+        int error = pthread_create(&worker->thread, NULL, replayWorker, worker);
+        if (error != 0) {
+            LOG_ERROR("Error starting a worker thread: %s", strerror(error));
+            break;
+        }
+        started++;
+    }
+
+    s_HeadlessResult total;
+    memset(&total, 0, sizeof(total));
+    int mismatches = 0;
+    bool broken = false;
+    for (int i = 0; i < started; i++) {
+        const s_ReplayWorker *worker = &workers[i];
+        pthread_join(worker->thread, NULL);
+        if (worker->status < 0) {
+            LOG_ERROR("The replay file %s is broken at byte %zu", options->replay, (size_t)(worker->cursor - corpus.data));
+            broken = true;
+        }
+        mismatches += worker->mismatches;
+        total.games += worker->result.games;
+        total.score += worker->result.score;
+        total.linesCleared += worker->result.linesCleared;
+        total.piecesPlaced += worker->result.piecesPlaced;
+    }
+    double seconds = (monotonicMicros() - start) / 1e6;
+
+    for (int i = 0; i < started; i++) {
+        const s_ReplayWorker *worker = &workers[i];
+        double perSecond = worker->seconds > 0 ? 1.0 / worker->seconds : 0.0;
+        printf("thread %d: %d games, %.0f games/s, %.0f placements/s\n", i, worker->result.games,
+               worker->result.games * perSecond, worker->result.piecesPlaced * perSecond);
+    }
+    printf("games: %d\n", total.games);
+    printf("mismatches: %d\n", mismatches);
+    printf("pieces placed: %lld\n", total.piecesPlaced);
+    printf("lines cleared: %lld\n", total.linesCleared);
+    printf("average score: %.2f\n", total.games ? (double)total.score / total.games : 0.0);
+    printf("time: %.3f s (%.0f games/s, %.0f placements/s)\n", seconds, seconds > 0 ? total.games / seconds : 0.0,
+           seconds > 0 ? total.piecesPlaced / seconds : 0.0);
+    free(workers);
+    closeReplayCorpus(&corpus);
+    return broken || mismatches > 0 || started < threads ? EXIT_FAILURE : 0;
+}
+
+/*
+ * Benchmarks for the core pieces of the game logic, run with --bench.
+ * Every kernel runs over a few fixed board corpora (always generated from the same seed, so two builds measure exactly
+ * the same work) and is repeated until it ran long enough to trust the clock. The output is one tab separated line per
+ * kernel and corpus, so two runs can be diffed or fed into a script:
+ *     kernel  corpus  ns_per_op  ops_per_sec  cycles_per_op
+ * cycles are only there where the CPU has a cheap cycle counter (x86), otherwise that column is "-".
+ */
+#define BENCH_SEED 20250413
+#define BENCH_BOARDS 256 // boards per corpus, a power of two so we can wrap with a mask
+#define BENCH_MIN_NANOS 200000000ull // every measurement runs at least 0.2 s
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_CYCLE_COUNTER 1
+static inline uint64_t readCycles() {
+    return __rdtsc();
+}
+#else
+#define HAVE_CYCLE_COUNTER 0
+static inline uint64_t readCycles() {
+    return 0;
+}
+#endif
+
+
+typedef struct {
+    const char *name;
+    s_Board boards[BENCH_BOARDS];
+    s_Tetromino candidates[BENCH_BOARDS]; // any position, valid or not, for the collision test
+    s_Tetromino landed[BENCH_BOARDS]; // a position where a piece really can come to rest on the board
+    s_Board placed[BENCH_BOARDS]; // the board with the landed piece in it, what clearLines gets after a lock
+} s_BenchCorpus;
+
+// fills the rows from firstRow down to the bottom with cells that are each filled with the given chance (in percent)
+static void fillRandomRows(s_Board *board, s_Random *random, int firstRow, int percent) {
+    for (int y = firstRow; y < BOARD_HEIGHT; y++) {
         for (int x = 0; x < BOARD_WIDTH; x++) {
-            printf("%c", tempBoard[y][x]); // this line here prints either a space or '#' and it fills the board with the element
+            if ((int)randomBelow(random, 100) < percent) {
+                board->rows[y] |= CELL_BIT(x);
+            }
+        }
+        if (board->rows[y] == FULL_ROW_MASK) {
+            board->rows[y] &= ~CELL_BIT(randomBelow(random, BOARD_WIDTH)); // full rows only where we want them
+        }
+    }
+}
+
+static void randomTetromino(s_Tetromino *tetromino, s_Random *random) {
+    tetromino->type = randomBelow(random, NUM_OF_SHAPES);
+    tetromino->rotation = randomBelow(random, 4);
+    tetromino->x = (int)randomBelow(random, BOARD_WIDTH + 2) - 1;
+    tetromino->y = (int)randomBelow(random, BOARD_HEIGHT + 2) - 1;
+}
+
+// drops random pieces from the top until one lands somewhere, if the board is too full for that the piece floats
+// in the first free spot from the top so there is always something valid to place
+static void landedTetromino(const s_Board *board, s_Tetromino *tetromino, s_Random *random) {
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        randomTetromino(tetromino, random);
+        tetromino->y = -TETROMINO_INFO[tetromino->type][tetromino->rotation].minY;
+        if (is_in_valid_position(board, tetromino)) {
+            while (moveTetrominoDown(board, tetromino)) {
+            }
+            return;
+        }
+    }
+    for (tetromino->y = -4; tetromino->y < BOARD_HEIGHT; tetromino->y++) {
+        for (tetromino->x = -1; tetromino->x < BOARD_WIDTH; tetromino->x++) {
+            if (is_in_valid_position(board, tetromino)) {
+                return;
+            }
+        }
+    }
+}
+
+// the bottom rows are full but for a hole that a random piece just fits in, and the piece is dropped into it, so those
+// rows are complete once it is placed (1 to 4 lines). The messy rows above keep the columns of the piece open so it
+// can fall all the way, pieces that still get stuck on their way down (an overhang of their own rows) are drawn again
+static void completedLinesBoard(s_Board *board, s_Tetromino *piece, s_Random *random) {
+    for (;;) {
+        initBoard(board);
+        piece->type = randomBelow(random, NUM_OF_SHAPES);
+        piece->rotation = randomBelow(random, 4);
+        const s_TetrominoInfo *info = &TETROMINO_INFO[piece->type][piece->rotation];
+        piece->x = (int)randomBelow(random, BOARD_WIDTH - (info->maxX - info->minX)) - info->minX;
+        int left = piece->x + info->minX;
+        int top = BOARD_HEIGHT - 1 - (info->maxY - info->minY);
+        board_row_t columns = 0;
+        for (int r = 0; r <= info->maxY - info->minY; r++) {
+            columns |= (board_row_t)info->rowMask[r] << left;
+        }
+        fillRandomRows(board, random, BOARD_HEIGHT / 2, 60);
+        for (int y = 0; y < top; y++) {
+            board->rows[y] &= ~columns;
+        }
+        for (int r = 0; r <= info->maxY - info->minY; r++) {
+            board->rows[top + r] = FULL_ROW_MASK & ~((board_row_t)info->rowMask[r] << left);
+        }
+        updateHeights(board, 0);
+        piece->y = -info->minY;
+        if (!is_in_valid_position(board, piece)) {
+            continue;
+        }
+        while (moveTetrominoDown(board, piece)) {
+        }
+        if (piece->y + info->minY == top) {
+            return;
+        }
+    }
+}
+
+static void initBenchCorpus(s_BenchCorpus *corpus, int kind) {
+    static const char *names[] = { "empty", "half-full", "near-topout", "completed-lines" };
+    s_Random random;
+    seedRandom(&random, BENCH_SEED + kind);
+    corpus->name = names[kind];
+    for (int i = 0; i < BENCH_BOARDS; i++) {
+        s_Board *board = &corpus->boards[i];
+        initBoard(board);
+        switch (kind) {
+            case 1:
+                fillRandomRows(board, &random, BOARD_HEIGHT / 2, 70);
+                break;
+            case 2:
+                fillRandomRows(board, &random, 3, 80);
+                break;
+            case 3:
+                completedLinesBoard(board, &corpus->landed[i], &random); // every piece that lands clears something
+                break;
+            default:
+                break;
+        }
+        updateHeights(board, 0);
+        randomTetromino(&corpus->candidates[i], &random);
+        if (kind != 3) {
+            landedTetromino(board, &corpus->landed[i], &random);
+        }
+        corpus->placed[i] = *board;
+        placeTetromino(&corpus->placed[i], &corpus->landed[i]);
+    }
+}
+
+static uint64_t benchCollision(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        valid += is_in_valid_position(&corpus->boards[n], &corpus->candidates[n]);
+    }
+    return valid;
+}
+
+static uint64_t benchPlace(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        s_Board board = corpus->boards[n];
+        placeTetromino(&board, &corpus->landed[n]);
+        sum += board.rows[BOARD_HEIGHT - 1];
+    }
+    return sum;
+}
+
+// on the completed-lines corpus every call clears lines, on the others this mostly measures the check
+static uint64_t benchClearLines(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t lines = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        s_Board board = corpus->placed[n];
+        lines += clearLines(&board, &corpus->landed[n]);
+    }
+    return lines;
+}
+
+// where a piece from the top of the board would land
+static uint64_t benchLandingRow(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        s_Tetromino piece = corpus->landed[n];
+        piece.y = -TETROMINO_INFO[piece.type][piece.rotation].minY;
+        sum += landingRow(&corpus->boards[n], &piece);
+    }
+    return sum;
+}
+
+// the collision kernel's candidates 16 at a time, all 16 against the board of the first one like the move generator
+// does it (one board per call), so which of them are valid is not the same as there. one op is one candidate, so the
+// time per op is what to compare
+static uint64_t benchBatchCollision(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < iterations; i += COLLISION_BATCH) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        valid += __builtin_popcount(batchValidPositions(&corpus->boards[n], &corpus->candidates[n], COLLISION_BATCH));
+    }
+    return valid;
+}
+
+// all placements of a piece starting from the top of the board
+static uint64_t benchPlacements(s_BenchCorpus *corpus, uint64_t iterations) {
+    static s_Placement placements[MAX_PLACEMENTS];
+    s_Arena arena;
+    if (!initArena(&arena, sizeof(s_PlacementRows) + ARENA_ALIGNMENT)) {
+        return 0;
+    }
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        s_Tetromino piece = corpus->landed[n];
+        piece.y = -TETROMINO_INFO[piece.type][piece.rotation].minY;
+        sum += generatePlacements(&corpus->boards[n], &piece, placements, &arena);
+    }
+    freeArena(&arena);
+    return sum;
+}
+
+static uint64_t benchRotate(s_BenchCorpus *corpus, uint64_t iterations) {
+    uint64_t rotated = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        s_Tetromino piece = corpus->landed[n];
+        rotated += rotateTetromino(&corpus->boards[n], &piece, i & 1 ? -1 : 1);
+    }
+    return rotated;
+}
+
+// this draws into /dev/null, every frame shows the next board of the corpus so there is always something to diff
+static uint64_t benchDisplay(s_BenchCorpus *corpus, uint64_t iterations) {
+    static s_Renderer renderer;
+    static s_GameState game;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open /dev/null: %s", strerror(errno));
+        return 0;
+    }
+    initRenderer(&renderer, fd);
+    initGame(&game, BENCH_SEED, RANDOMIZER_UNIFORM);
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t n = i & (BENCH_BOARDS - 1);
+        game.board = corpus->boards[n];
+        game.piece = corpus->landed[n];
+        displayGame(&renderer, &game, ALL_BOARD_ROWS); // a whole new board every time
+    }
+    close(fd);
+    return renderer.hasPrevious;
+}
+
+// the common frame while playing, the board stays and the piece moves one column
+static uint64_t benchDisplayMove(s_BenchCorpus *corpus, uint64_t iterations) {
+    static s_Renderer renderer;
+    static s_GameState game;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open /dev/null: %s", strerror(errno));
+        return 0;
+    }
+    initRenderer(&renderer, fd);
+    initGame(&game, BENCH_SEED, RANDOMIZER_UNIFORM);
+    game.board = corpus->boards[0];
+    game.piece = corpus->landed[0];
+    for (uint64_t i = 0; i < iterations; i++) {
+        // back and forth, if it can't go one way it goes the other
+        if (!(i & 1 ? moveTetrominoRight(&game.board, &game.piece) : moveTetrominoLeft(&game.board, &game.piece))) {
+            i & 1 ? moveTetrominoLeft(&game.board, &game.piece) : moveTetrominoRight(&game.board, &game.piece);
+        }
+        displayGame(&renderer, &game, takeDirtyRows(&game.board));
+    }
+    close(fd);
+    return renderer.hasPrevious;
+}
+
+// a new game from its seed, what every session and every headless game starts with
+static uint64_t benchInitGame(s_BenchCorpus *corpus, uint64_t iterations) {
+    (void)corpus;
+    static s_GameState game;
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        initGame(&game, BENCH_SEED + i, RANDOMIZER_UNIFORM);
+        sum += game.next[0];
+    }
+    return sum;
+}
+
+static uint64_t benchStartSession(s_BenchCorpus *corpus, uint64_t iterations); // it needs the server, see there
+
+typedef struct {
+    const char *name;
+    uint64_t (*run)(s_BenchCorpus *corpus, uint64_t iterations);
+    bool boardless; // it does not look at the corpus, one run is enough and its corpus column is "-"
+} s_BenchKernel;
+
+static const s_BenchKernel BENCH_KERNELS[] = {
+    { "is_in_valid_position", benchCollision, false },
+    { "placeTetromino", benchPlace, false },
+    { "clearLines", benchClearLines, false },
+    { "rotateTetromino", benchRotate, false },
+    { "landingRow", benchLandingRow, false },
+    { "generatePlacements", benchPlacements, false },
+    { "batchValidPositions", benchBatchCollision, false },
+    { "displayGame", benchDisplay, false },
+    { "displayGame_move", benchDisplayMove, false },
+    { "initGame", benchInitGame, true },
+    { "startSession", benchStartSession, true }
+};
+
+volatile uint64_t benchSink; // results end up here so the compiler can't throw the work away
+
+static void runBenchKernel(const s_BenchKernel *kernel, s_BenchCorpus *corpus) {
+    uint64_t iterations = 1024;
+    uint64_t nanos, cycles;
+    for (;;) {
+        uint64_t startCycles = readCycles();
+        uint64_t start = monotonicNanos();
+        benchSink += kernel->run(corpus, iterations);
+        nanos = monotonicNanos() - start;
+        cycles = readCycles() - startCycles;
+        if (nanos >= BENCH_MIN_NANOS) {
+            break;
+        }
+        iterations *= 2;
+    }
+    double nsPerOp = (double)nanos / iterations;
+    printf("%s\t%s\t%.3f\t%.0f\t", kernel->name, kernel->boardless ? "-" : corpus->name, nsPerOp, 1e9 / nsPerOp);
+    if (HAVE_CYCLE_COUNTER) {
+        printf("%.2f\n", (double)cycles / iterations);
+    } else {
+        printf("-\n");
+    }
+    fflush(stdout);
+}
+
+// the bot has to make the same moves with any number of search threads, each of them has its own table and gets the
+// root moves in whatever order they come, so this plays a game with one and with a few and compares every move
+#define CHECK_SEARCH_DEPTH 3
+#define CHECK_SEARCH_THREADS 4
+#define CHECK_SEARCH_MOVES 32
+#define CHECK_SEARCH_SEED 3 // with values that came out of a table a thread had or didn't have this one is off by move 23
+
+static bool checkSearchThreads() {
+    s_Searcher *single = createSearcher(CHECK_SEARCH_DEPTH, 1);
+    s_Searcher *several = createSearcher(CHECK_SEARCH_DEPTH, CHECK_SEARCH_THREADS);
+    bool same = single && several;
+    if (!same) {
+        LOG_ERROR("Error allocating the search tables");
+    }
+    s_GameState game;
+    initGame(&game, CHECK_SEARCH_SEED, RANDOMIZER_UNIFORM);
+    int moves = 0;
+    while (same && !game.gameOver && moves < CHECK_SEARCH_MOVES) {
+        s_Placement first, second;
+        bool found = findBestPlacement(single, &game, &first);
+        // the value too, down to the last bit, a move can survive a small difference in it
+        if (found != findBestPlacement(several, &game, &second) ||
+            (found && (first.x != second.x || first.y != second.y || first.rotation != second.rotation ||
+                       single->value != several->value))) {
+            LOG_ERROR("The search with %d threads picked another move than with 1 (move %d)", CHECK_SEARCH_THREADS,
+                      moves);
+            same = false;
+        } else if (!found) {
+            break;
+        } else {
+            applyPlacement(&game, &first);
+            moves++;
+        }
+    }
+    if (same) {
+        printf("# search: 1 and %d threads make the same %d moves at depth %d\n", CHECK_SEARCH_THREADS, moves,
+               CHECK_SEARCH_DEPTH);
+    }
+    destroySearcher(single);
+    destroySearcher(several);
+    return same;
+}
+
+int runBenchmarks() {
+    if (!checkSearchThreads()) {
+        return EXIT_FAILURE;
+    }
+    static s_BenchCorpus corpora[4];
+    for (int kind = 0; kind < 4; kind++) {
+        initBenchCorpus(&corpora[kind], kind);
+    }
+    printf("# kernel\tcorpus\tns_per_op\tops_per_sec\tcycles_per_op\n");
+    for (size_t k = 0; k < sizeof(BENCH_KERNELS) / sizeof(BENCH_KERNELS[0]); k++) {
+        for (int kind = 0; kind < (BENCH_KERNELS[k].boardless ? 1 : 4); kind++) {
+            runBenchKernel(&BENCH_KERNELS[k], &corpora[kind]);
+        }
+    }
+    return 0;
+}
+
+/*
+ * The event loop for the server, epoll on Linux and kqueue on macOS and the BSDs, behind the same few calls.
+ * Every fd is always watched for reading and for writing only while it has output that did not fit into the socket.
+ * Both are level triggered, so a read can stop with input left and the next wait comes back for the rest. Every
+ * connection gets a few reads per round, one that never stops sending can't keep the others waiting.
+ */
+#define MAX_EVENTS 256
+#define MAX_READS_PER_EVENT 4
+
+typedef struct {
+    void *data;
+    bool readable;
+    bool writable;
+} s_Event;
+
+#ifdef __linux__
+static int createEventLoop() {
+    return epoll_create1(EPOLL_CLOEXEC);
+}
+
+static bool watchFd(int loop, int fd, void *data, bool writable, bool added) {
+    struct epoll_event event = { .events = EPOLLIN | (writable ? EPOLLOUT : 0), .data.ptr = data };
+    return epoll_ctl(loop, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void unwatchFd(int loop, int fd) {
+    epoll_ctl(loop, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int waitEvents(int loop, s_Event *events, int timeout) {
+    struct epoll_event ready[MAX_EVENTS];
+    int count = epoll_wait(loop, ready, MAX_EVENTS, timeout);
+    for (int i = 0; i < count; i++) {
+        events[i].data = ready[i].data.ptr;
+        events[i].readable = (ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0; // the read will see what it is
+        events[i].writable = (ready[i].events & EPOLLOUT) != 0;
+    }
+    return count;
+}
+#else
+static int createEventLoop() {
+    return kqueue();
+}
+
+// kqueue has a filter for reading and one for writing, the write one is there all the time and just switched on and off
+static bool watchFd(int loop, int fd, void *data, bool writable, bool added) {
+    struct kevent changes[2];
+    int count = 0;
+    if (!added) {
+        EV_SET(&changes[count++], fd, EVFILT_READ, EV_ADD, 0, 0, data);
+    }
+    EV_SET(&changes[count++], fd, EVFILT_WRITE, EV_ADD | (writable ? EV_ENABLE : EV_DISABLE), 0, 0, data);
+    return kevent(loop, changes, count, NULL, 0, NULL) == 0;
+}
+
+static void unwatchFd(int loop, int fd) {
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(loop, changes, 2, NULL, 0, NULL);
+}
+
+static int waitEvents(int loop, s_Event *events, int timeout) {
+    struct kevent ready[MAX_EVENTS];
+    struct timespec wait = { .tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000L };
+    int count = kevent(loop, NULL, 0, ready, MAX_EVENTS, timeout < 0 ? NULL : &wait);
+    for (int i = 0; i < count; i++) {
+        events[i].data = ready[i].udata;
+        events[i].readable = ready[i].filter == EVFILT_READ;
+        events[i].writable = ready[i].filter == EVFILT_WRITE;
+    }
+    return count;
+}
+#endif
+
+/*
+ * Spectator frames, a watched game goes out as a stream of small binary frames instead of the ANSI output of the
+ * renderer, so it is encoded once no matter how many are watching and the viewer draws it with its own renderer.
+ * Every frame is a 2 byte length (of what follows, little endian like everything here) and a type:
+ *     'K' keyframe  width, height, hidden rows, queue length, then every row of the board, then the status
+ *     'D' delta     the dirty row mask (8 bytes), the rows that are set in it, then the status
+ *     'E' end       the final score (4 bytes)
+ * a row is BROADCAST_ROW_BYTES bytes and the status is the piece (x, y, type, rotation), score, level and lines
+ * (4 bytes each) and the queue. A keyframe is sent every BROADCAST_KEYFRAME_INTERVAL frames, somebody who starts
+ * watching gets the last keyframe and the deltas after it.
+ */
+#define BROADCAST_ROW_BYTES ((BOARD_WIDTH + 7) / 8)
+#define BROADCAST_STATUS_SIZE (4 + 3 * 4 + NEXT_PIECES)
+#define BROADCAST_MAX_FRAME (3 + 4 + BOARD_HEIGHT * BROADCAST_ROW_BYTES + 8 + BROADCAST_STATUS_SIZE)
+#define BROADCAST_KEYFRAME_INTERVAL 64
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+} s_FrameLog;
+
+// makes room for one more frame, false if we are out of memory
+static bool reserveFrame(s_FrameLog *log) {
+    if (log->length + BROADCAST_MAX_FRAME <= log->capacity) {
+        return true;
+    }
+    size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+    uint8_t *data = realloc(log->data, capacity);
+    if (!data) {
+        return false;
+    }
+    log->data = data;
+    log->capacity = capacity;
+    return true;
+}
+
+static uint8_t *putLittle(uint8_t *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *out++ = (uint8_t)(value >> (8 * i));
+    }
+    return out;
+}
+
+static uint64_t getLittle(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint8_t *putStatus(uint8_t *out, const s_GameState *game) {
+    *out++ = (uint8_t)game->piece.x;
+    *out++ = (uint8_t)game->piece.y;
+    *out++ = game->piece.type;
+    *out++ = game->piece.rotation;
+    out = putLittle(out, (uint32_t)game->score, 4);
+    out = putLittle(out, (uint32_t)gameLevel(game), 4);
+    out = putLittle(out, (uint32_t)game->linesCleared, 4);
+    memcpy(out, game->next, NEXT_PIECES);
+    return out + NEXT_PIECES;
+}
+
+// the length in front is only known at the end, so it is filled in last
+static void finishFrame(s_FrameLog *log, uint8_t *end) {
+    uint8_t *start = log->data + log->length;
+    putLittle(start, (uint64_t)(end - start - 2), 2);
+    log->length = end - log->data;
+}
+
+bool encodeKeyframe(s_FrameLog *log, const s_GameState *game) {
+    if (!reserveFrame(log)) {
+        return false;
+    }
+    uint8_t *out = log->data + log->length + 2;
+    *out++ = 'K';
+    *out++ = BOARD_WIDTH;
+    *out++ = BOARD_HEIGHT;
+    *out++ = BOARD_HIDDEN_ROWS;
+    *out++ = NEXT_PIECES;
+    for (int y = 0; y < BOARD_HEIGHT; y++) {
+        out = putLittle(out, game->board.rows[y], BROADCAST_ROW_BYTES);
+    }
+    finishFrame(log, putStatus(out, game));
+    return true;
+}
+
+bool encodeDelta(s_FrameLog *log, const s_GameState *game, uint64_t dirtyRows) {
+    if (!reserveFrame(log)) {
+        return false;
+    }
+    uint8_t *out = log->data + log->length + 2;
+    *out++ = 'D';
+    out = putLittle(out, dirtyRows, 8);
+    for (uint64_t rows = dirtyRows; rows; rows &= rows - 1) {
+        out = putLittle(out, game->board.rows[__builtin_ctzll(rows)], BROADCAST_ROW_BYTES);
+    }
+    finishFrame(log, putStatus(out, game));
+    return true;
+}
+
+bool encodeEnd(s_FrameLog *log, int score) {
+    if (!reserveFrame(log)) {
+        return false;
+    }
+    uint8_t *out = log->data + log->length + 2;
+    *out++ = 'E';
+    finishFrame(log, putLittle(out, (uint32_t)score, 4));
+    return true;
+}
+
+/*
+ * The other end, applies one frame to the game of the viewer. game is only what is needed to draw it (the board,
+ * the piece, score, level, lines and the queue), the dirty rows of its board say what the frame changed.
+ * Returns the length of the frame, 0 if it is not complete yet and -1 if it is broken or from a different build.
+ */
+int decodeFrame(const uint8_t *data, size_t length, s_GameState *game, bool *ended) {
+    if (length < 3) {
+        return 0;
+    }
+    size_t size = getLittle(data, 2);
+    if (length < size + 2) {
+        return 0;
+    }
+    const uint8_t *in = data + 3;
+    const uint8_t *end = data + 2 + size;
+    size_t rows = 0;
+    switch (data[2]) {
+        case 'K':
+            if (size != 1 + 4 + BOARD_HEIGHT * BROADCAST_ROW_BYTES + BROADCAST_STATUS_SIZE || in[0] != BOARD_WIDTH ||
+                in[1] != BOARD_HEIGHT || in[2] != BOARD_HIDDEN_ROWS || in[3] != NEXT_PIECES) {
+                return -1;
+            }
+            in += 4;
+            for (int y = 0; y < BOARD_HEIGHT; y++, in += BROADCAST_ROW_BYTES) {
+                game->board.rows[y] = (board_row_t)getLittle(in, BROADCAST_ROW_BYTES) & FULL_ROW_MASK;
+            }
+            game->board.dirtyRows = ALL_BOARD_ROWS;
+            break;
+        case 'D': {
+            if (size < 1 + 8) {
+                return -1;
+            }
+            uint64_t dirty = getLittle(in, 8) & ALL_BOARD_ROWS;
+            in += 8;
+            rows = __builtin_popcountll(dirty);
+            if (size != 1 + 8 + rows * BROADCAST_ROW_BYTES + BROADCAST_STATUS_SIZE) {
+                return -1;
+            }
+            for (; dirty; dirty &= dirty - 1, in += BROADCAST_ROW_BYTES) {
+                game->board.rows[__builtin_ctzll(dirty)] = (board_row_t)getLittle(in, BROADCAST_ROW_BYTES) & FULL_ROW_MASK;
+                game->board.dirtyRows |= dirty & -dirty;
+            }
+            break;
+        }
+        case 'E':
+            if (size != 1 + 4) {
+                return -1;
+            }
+            game->score = (int)getLittle(in, 4);
+            *ended = true;
+            return (int)(size + 2);
+        default:
+            return -1;
+    }
+    // the status, the ghost needs the heights so they are worked out again too
+    if (end - in != BROADCAST_STATUS_SIZE || in[2] >= NUM_OF_SHAPES || in[3] > 3 || (int8_t)in[0] < -3 ||
+        (int8_t)in[0] > BOARD_WIDTH || (int8_t)in[1] < -3 || (int8_t)in[1] > BOARD_HEIGHT) {
+        return -1;
+    }
+    game->piece.x = (int8_t)in[0];
+    game->piece.y = (int8_t)in[1];
+    game->piece.type = in[2];
+    game->piece.rotation = in[3];
+    game->score = (int)getLittle(in + 4, 4);
+    game->linesCleared = (int)getLittle(in + 12, 4); // the level in between follows from these
+    for (int i = 0; i < NEXT_PIECES; i++) {
+        game->next[i] = in[16 + i] < NUM_OF_SHAPES ? in[16 + i] : 0;
+    }
+    updateHeights(&game->board, 0);
+    return (int)(size + 2);
+}
+
+/*
+ * Server mode, every TCP connection is a player with its own game and renderer and all of them run on the one event
+ * loop above, so a few thousand players are one process and a few MB. The clients are plain telnet: we tell it we do
+ * the echo and don't need go-aheads, that puts it into character mode, and everything else it negotiates is skipped.
+ * Time is one scheduler for everybody, every game counts its ticks from when the player connected and is only brought
+ * up to date when something happens to it: a key comes in or its next drop is due. The due drops are kept in a heap,
+ * so a wakeup only ever touches the sessions it is about and not all of them.
+ * Nothing in here ever blocks, a frame that does not fit into the socket waits in the renderer buffer and the next one
+ * is only drawn when it is out (the session keeps the dirty rows until then, so nothing is lost).
+ * With --spectate there is a second port for watching the games. A spectator sends the number of the game it wants
+ * (or an empty line for the oldest one) and gets the frames from above. The frames of a game are encoded once into its
+ * broadcast log and every spectator is sent straight out of that log, it is only the offset that is different for
+ * each of them. A spectator that falls too far behind is dropped instead of the log growing without end.
+ */
+#define TELNET_IAC 255
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_SB 250
+#define TELNET_SE 240
+#define TELNET_ECHO 1
+#define TELNET_SUPPRESS_GO_AHEAD 3
+
+#define POOL_SLAB_OBJECTS 64 // sessions, spectators and broadcasts come from the pools 64 at a time
+#define BROADCAST_MAX_BACKLOG (256 * 1024) // a spectator that has this much of the log not sent yet is dropped
+
+// what an fd in the event loop belongs to, the structs the event data points to all start with this
+typedef enum {
+    CONNECTION_PLAYER_LISTENER,
+    CONNECTION_SPECTATOR_LISTENER,
+    CONNECTION_PLAYER,
+    CONNECTION_SPECTATOR
+} e_Connection;
+
+// where the telnet parser is between two reads
+typedef enum {
+    TELNET_DATA,
+    TELNET_COMMAND, // after IAC
+    TELNET_OPTION, // after IAC WILL/WONT/DO/DONT, the option byte comes next
+    TELNET_SUBNEGOTIATION, // between IAC SB and IAC SE
+    TELNET_SUBNEGOTIATION_IAC
+} e_TelnetState;
+
+typedef struct {
+    uint8_t kind; // an e_Connection
+    int fd; // -1 if it is not open
+    bool accepting; // false while we are out of fds
+} s_Listener;
+
+typedef struct s_Broadcast s_Broadcast;
+
+typedef struct {
+    uint8_t kind; // an e_Connection
+    int fd;
+    int slot; // in the spectator list of its broadcast
+    size_t offset; // how much of the broadcast log it was sent already
+    bool blocked;
+    bool gone;
+    s_Broadcast *broadcast; // NULL until it said which game it wants
+    size_t requestLength;
+    char request[16];
+} s_Spectator;
+
+typedef struct {
+    uint8_t kind; // an e_Connection
+    int fd;
+    int index; // in the session list
+    int timer; // in the timer heap, -1 once the game does not drop anymore
+    uint64_t startTick; // scheduler tick the game started on
+    size_t sent; // how much of the renderer buffer is out already
+    bool redraw;
+    bool closing; // the game is over or the player quit, the session ends once the last frame is out
+    bool blocked; // the socket was full, we are watching for it to have room again
+    bool gone; // the connection is closed or broken, the session is dropped at the end of this round
+    bool touched; // it is in the list of sessions to look at at the end of this round
+    uint8_t telnet; // an e_TelnetState
+    uint8_t input; // an e_InputState, the arrow keys come in as escape sequences here too
+    uint64_t dirtyRows; // board rows that changed since the last frame that was drawn
+    uint64_t keyTime; // when the first key the next frame shows was read, 0 if there is none
+    uint64_t steps; // keys played, for the results
+    s_AutoShift shift;
+    s_Broadcast *broadcast; // NULL while nobody is watching
+    s_GameState game;
+    s_GameStats stats; // for the results
+    s_ReplayWriter replay;
+    s_Renderer renderer;
+} s_Session;
+
+// the frames of a game that is being watched
+struct s_Broadcast {
+    s_Session *session; // NULL once the game is over, the broadcast is gone when the spectators have the end
+    s_FrameLog log;
+    size_t keyframe; // where the last keyframe starts, new spectators start there
+    int frames; // since that keyframe
+    uint8_t status[BROADCAST_STATUS_SIZE]; // of the last frame, a frame that would not change anything is not sent
+    s_Spectator **spectators;
+    int count;
+    int capacity;
+};
+
+typedef struct {
+    int loop;
+    s_Listener playerListener;
+    s_Listener spectatorListener;
+    const s_Options *options;
+    uint64_t gamesStarted;
+    s_TickScheduler scheduler;
+    s_Session **sessions;
+    s_Session **timers; // a min heap on the tick of the next drop
+    s_Session **touched;
+    int count;
+    int timerCount;
+    int touchedCount;
+    int capacity;
+    s_Spectator **spectators;
+    int spectatorCount;
+    int spectatorCapacity;
+    bool spectatorsGone; // some of them are gone this round
+    s_Pool sessionPool;
+    s_Pool spectatorPool;
+    s_Pool broadcastPool;
+    s_ResultWriter results; // its fd is -1 without --results
+    uint64_t resultsFlushTick; // the records that are waiting go out on this tick, if the batch is not full before
+} s_Server;
+
+// the scheduler tick the next drop of the session is due on
+static inline uint64_t sessionDueTick(const s_Session *session) {
+    uint64_t drop = nextDropTick(&session->game);
+    uint64_t shift = autoShiftDueTick(&session->shift);
+    return session->startTick + (drop < shift ? drop : shift);
+}
+
+static void swapTimers(s_Server *server, int a, int b) {
+    s_Session *session = server->timers[a];
+    server->timers[a] = server->timers[b];
+    server->timers[b] = session;
+    server->timers[a]->timer = a;
+    server->timers[b]->timer = b;
+}
+
+// puts the session back where it belongs in the heap after its due tick changed, or takes it out if it has none
+static void updateTimer(s_Server *server, s_Session *session) {
+    int i = session->timer;
+    if (i < 0) {
+        return;
+    }
+    if (session->closing || session->gone) {
+        swapTimers(server, i, --server->timerCount);
+        session->timer = -1;
+        if (i == server->timerCount) {
+            return;
+        }
+        session = server->timers[i];
+    }
+    uint64_t due = sessionDueTick(session);
+    while (i > 0 && due < sessionDueTick(server->timers[(i - 1) / 2])) {
+        swapTimers(server, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        int smallest = i;
+        for (int child = 2 * i + 1; child <= 2 * i + 2 && child < server->timerCount; child++) {
+            if (sessionDueTick(server->timers[child]) < sessionDueTick(server->timers[smallest])) {
+                smallest = child;
+            }
+        }
+        if (smallest == i) {
+            break;
+        }
+        swapTimers(server, i, smallest);
+        i = smallest;
+    }
+}
+
+// remembers to draw and send the session at the end of this round
+static void touchSession(s_Server *server, s_Session *session) {
+    if (!session->touched) {
+        session->touched = true;
+        server->touched[server->touchedCount++] = session;
+    }
+}
+
+// lets the game of the session catch up with the server clock
+static void catchUpSession(s_Server *server, s_Session *session) {
+    uint64_t before = nextDropTick(&session->game);
+    int x = session->game.piece.x;
+    advanceAutoShift(&session->shift, &session->game, server->scheduler.tick - session->startTick,
+                     server->options->recordFd >= 0 ? &session->replay : NULL);
+    updateGameStats(&session->stats, &session->game);
+    if (nextDropTick(&session->game) != before || session->game.piece.x != x) {
+        session->redraw = true;
+    }
+    if (session->game.gameOver) {
+        session->closing = true;
+    }
+}
+
+// keys the peer sent that we did not read would turn the close into a reset, which can lose the last frame
+// there is one read for them and not a loop, a peer that keeps sending would hold up the whole event loop, and
+// whatever it sends after this is its own problem
+static void closeConnection(int fd) {
+    char discard[4096];
+    recv(fd, discard, sizeof(discard), 0);
+    close(fd); // this also takes it out of the event loop
+}
+
+// a fd was closed, so a listener that stopped because we were out of them can go on
+static void resumeListeners(s_Server *server) {
+    s_Listener *listeners[] = { &server->playerListener, &server->spectatorListener };
+    for (int i = 0; i < 2; i++) {
+        if (listeners[i]->fd >= 0 && !listeners[i]->accepting) {
+            listeners[i]->accepting = watchFd(server->loop, listeners[i]->fd, listeners[i], false, false);
+        }
+    }
+}
+
+// the spectator is closed at the end of the round, the events of this round may still point at it
+static void dropSpectator(s_Server *server, s_Spectator *spectator) {
+    spectator->gone = true;
+    server->spectatorsGone = true;
+}
+
+static void freeBroadcast(s_Server *server, s_Broadcast *broadcast) {
+    if (broadcast->session) {
+        broadcast->session->broadcast = NULL;
+    }
+    free(broadcast->log.data);
+    free(broadcast->spectators);
+    poolFree(&server->broadcastPool, broadcast);
+}
+
+// sends the spectator the part of the log it does not have yet, false if it is gone or has the whole game that ended
+static bool sendSpectator(s_Server *server, s_Spectator *spectator) {
+    const s_FrameLog *log = &spectator->broadcast->log;
+    while (spectator->offset < log->length) {
+        ssize_t n = send(spectator->fd, log->data + spectator->offset, log->length - spectator->offset, 0);
+        if (n > 0) {
+            spectator->offset += n;
+            countStat(COUNTER_SOCKET_BYTES, n);
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (spectator->blocked) {
+                return true;
+            }
+            spectator->blocked = true;
+            return watchFd(server->loop, spectator->fd, spectator, true, true);
+        } else {
+            return false;
+        }
+    }
+    bool waited = spectator->blocked;
+    spectator->blocked = false;
+    if (waited && !watchFd(server->loop, spectator->fd, spectator, false, true)) {
+        return false;
+    }
+    return spectator->broadcast->session != NULL;
+}
+
+// sends the new frames to everybody watching, the blocked ones get them once their socket has room again
+static void sendBroadcast(s_Server *server, s_Broadcast *broadcast) {
+    for (int i = 0; i < broadcast->count; i++) {
+        s_Spectator *spectator = broadcast->spectators[i];
+        if (spectator->gone) {
+            continue;
+        }
+        if (broadcast->log.length - spectator->offset > BROADCAST_MAX_BACKLOG) {
+            LOG_DEBUG("Spectator %d is too far behind", spectator->fd);
+            dropSpectator(server, spectator);
+        } else if (!spectator->blocked && !sendSpectator(server, spectator)) {
+            dropSpectator(server, spectator);
         }
-        printf("|\n"); // at the end it prints one vertical line at the end 
     }
+}
 
-    // now we draw the bottom border
-    printf("+");
-    for (int x = 0; x < BOARD_WIDTH; x++) { // we need here x
-        printf("-");
+// throws away the frames that all the spectators have already, done right before a keyframe so new ones never need them
+static void trimBroadcast(s_Broadcast *broadcast) {
+    size_t cut = broadcast->log.length;
+    for (int i = 0; i < broadcast->count; i++) {
+        if (!broadcast->spectators[i]->gone && broadcast->spectators[i]->offset < cut) {
+            cut = broadcast->spectators[i]->offset;
+        }
+    }
+    memmove(broadcast->log.data, broadcast->log.data + cut, broadcast->log.length - cut);
+    broadcast->log.length -= cut;
+    for (int i = 0; i < broadcast->count; i++) {
+        s_Spectator *spectator = broadcast->spectators[i];
+        spectator->offset = spectator->offset > cut ? spectator->offset - cut : 0;
     }
-    printf("+\n");
-    printf("DEBUG: Tetromino position: x=%d, y=%d, type=%d, rotation=%d\n", 
-       tetromino->x, tetromino->y, tetromino->type, tetromino->rotation);
 }
 
-// now we need to move the lines, clear the lines:
-int clearLines() {
-    int linesCleared = 0;
+// puts what changed in the game of the session into its broadcast log and sends it
+static void broadcastGame(s_Server *server, s_Broadcast *broadcast, uint64_t dirtyRows) {
+    const s_GameState *game = &broadcast->session->game;
+    s_FrameLog *log = &broadcast->log;
+    bool encoded;
+    if (broadcast->frames >= BROADCAST_KEYFRAME_INTERVAL) {
+        trimBroadcast(broadcast);
+        broadcast->keyframe = log->length;
+        broadcast->frames = 0;
+        encoded = encodeKeyframe(log, game);
+    } else {
+        size_t start = log->length;
+        encoded = encodeDelta(log, game, dirtyRows);
+        if (encoded && !dirtyRows &&
+            memcmp(log->data + log->length - BROADCAST_STATUS_SIZE, broadcast->status, BROADCAST_STATUS_SIZE) == 0) {
+            log->length = start; // nothing the spectators could see
+            return;
+        }
+        broadcast->frames++;
+    }
+    if (!encoded) {
+        LOG_ERROR("Out of memory for the broadcast of game %d", broadcast->session->fd);
+        for (int i = 0; i < broadcast->count; i++) {
+            dropSpectator(server, broadcast->spectators[i]);
+        }
+        return;
+    }
+    memcpy(broadcast->status, log->data + log->length - BROADCAST_STATUS_SIZE, BROADCAST_STATUS_SIZE);
+    sendBroadcast(server, broadcast);
+}
+
+// the game of the broadcast is over, the spectators get the end and are closed once they have it
+static void endBroadcast(s_Server *server, s_Broadcast *broadcast) {
+    int score = broadcast->session->game.score;
+    broadcast->session->broadcast = NULL;
+    broadcast->session = NULL;
+    if (broadcast->count == 0) {
+        freeBroadcast(server, broadcast);
+        return;
+    }
+    if (!encodeEnd(&broadcast->log, score)) {
+        for (int i = 0; i < broadcast->count; i++) {
+            dropSpectator(server, broadcast->spectators[i]);
+        }
+        return;
+    }
+    sendBroadcast(server, broadcast);
+}
 
-    // start from way down below
-    for (int y = BOARD_HEIGHT - 1; y >= 0; y--) {
-        bool lineComplete = true;
+static void closeSession(s_Server *server, s_Session *session) {
+    session->gone = true;
+    updateTimer(server, session);
+    if (server->options->recordFd >= 0) {
+        endReplay(&session->replay, &session->game, server->options->recordFd);
+    }
+    freeReplay(&session->replay);
+    if (server->results.fd >= 0) {
+        addResult(&server->results, &session->game, &session->stats,
+                  (server->scheduler.tick - session->startTick) * TICK_MICROS, session->steps, RESULT_SERVER);
+        if (server->results.count == 1) {
+            server->resultsFlushTick = server->scheduler.tick + RESULTS_FLUSH_MICROS / TICK_MICROS;
+        }
+    }
+    if (session->broadcast) {
+        endBroadcast(server, session->broadcast);
+    }
+    LOG_DEBUG("Session %d closed, score %d", session->fd, session->game.score);
+    closeConnection(session->fd);
+    server->sessions[session->index] = server->sessions[--server->count];
+    server->sessions[session->index]->index = session->index;
+    poolFree(&server->sessionPool, session);
+    resumeListeners(server);
+}
 
-        // now we check if this line is complete 
-        for (int x = 0; x < BOARD_WIDTH; x++) {
-            if (board[y][x] == EMPTY_CELL) {
-                lineComplete = false;
-                break;
+// sends what it can of the pending output, returns false if the connection is gone
+static bool sendSession(s_Server *server, s_Session *session) {
+    s_Renderer *renderer = &session->renderer;
+    while (session->sent < renderer->length) {
+        ssize_t n = send(session->fd, renderer->out + session->sent, renderer->length - session->sent, 0);
+        if (n > 0) {
+            session->sent += n;
+            countStat(COUNTER_SOCKET_BYTES, n);
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the rest goes when the socket has room again
+            if (session->blocked) {
+                return true;
             }
+            session->blocked = true;
+            return watchFd(server->loop, session->fd, session, true, true);
+        } else {
+            return false;
         }
+    }
+    // all out, if we were waiting for room we don't need to anymore
+    bool waited = session->blocked;
+    renderer->length = 0;
+    session->sent = 0;
+    session->blocked = false;
+    return !waited || watchFd(server->loop, session->fd, session, false, true);
+}
 
-        if (lineComplete) {
-            linesCleared++;
+// everything of a new session that is not about its connection, --bench times this
+static void initSession(s_Session *session, const s_Options *options, uint64_t seed, uint64_t tick) {
+    memset(session, 0, offsetof(s_Session, renderer)); // the renderer is last and only needs initRenderer
+    session->kind = CONNECTION_PLAYER;
+    session->fd = -1;
+    session->startTick = tick;
+    session->redraw = true;
+    session->telnet = TELNET_DATA;
+    session->input = INPUT_KEY;
+    initAutoShift(&session->shift, options->das, options->arr);
+    initGame(&session->game, seed, options->randomizer);
+    initGameStats(&session->stats, &session->game);
+    initRenderer(&session->renderer, -1); // no fd, the frames stay in the buffer and we send them
+}
+
+// a session coming and going without the socket, with the other kernels it is down in the bench
+static uint64_t benchStartSession(s_BenchCorpus *corpus, uint64_t iterations) {
+    (void)corpus;
+    s_Options options = { .das = DEFAULT_DAS, .arr = DEFAULT_ARR, .randomizer = RANDOMIZER_UNIFORM };
+    s_Pool pool;
+    initPool(&pool, sizeof(s_Session), POOL_SLAB_OBJECTS);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        s_Session *session = poolAlloc(&pool);
+        initSession(session, &options, BENCH_SEED + i, i);
+        sum += session->game.next[0];
+        poolFree(&pool, session);
+    }
+    freePool(&pool);
+    return sum;
+}
+
+static void startSession(s_Server *server, int fd) {
+    if (server->count == server->capacity) {
+        int capacity = server->capacity ? server->capacity * 2 : 64;
+        s_Session **sessions = realloc(server->sessions, capacity * sizeof(*sessions));
+        s_Session **timers = sessions ? realloc(server->timers, capacity * sizeof(*timers)) : NULL;
+        s_Session **touched = timers ? realloc(server->touched, capacity * sizeof(*touched)) : NULL;
+        server->sessions = sessions ? sessions : server->sessions;
+        server->timers = timers ? timers : server->timers;
+        server->touched = touched ? touched : server->touched;
+        if (!touched) {
+            LOG_ERROR("Out of memory for a new session");
+            close(fd);
+            return;
+        }
+        server->capacity = capacity;
+    }
+    s_Session *session = poolAlloc(&server->sessionPool);
+    if (!session) {
+        LOG_ERROR("Out of memory for a new session");
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // every frame is one small write, no need to wait for more
+    initSession(session, server->options, server->options->seed + server->gamesStarted++, server->scheduler.tick);
+    session->fd = fd;
+    if (server->options->recordFd >= 0) {
+        beginReplay(&session->replay, &session->game);
+    }
+    session->index = server->count;
+    server->sessions[server->count++] = session;
+    session->timer = server->timerCount;
+    server->timers[server->timerCount++] = session;
+    updateTimer(server, session);
+    if (!watchFd(server->loop, fd, session, false, false)) {
+        LOG_ERROR("Error watching a new session: %s", strerror(errno));
+        closeSession(server, session);
+        return;
+    }
+    // character mode please, that goes out right away and the first frame at the end of the round
+    static const uint8_t negotiation[] = { TELNET_IAC, TELNET_WILL, TELNET_ECHO, TELNET_IAC, TELNET_WILL,
+                                           TELNET_SUPPRESS_GO_AHEAD, TELNET_IAC, TELNET_DO, TELNET_SUPPRESS_GO_AHEAD };
+    appendOutput(&session->renderer, (const char *)negotiation, sizeof(negotiation));
+    if (!sendSession(server, session)) {
+        session->gone = true;
+    }
+    touchSession(server, session);
+    LOG_DEBUG("Session %d started with seed %llu", fd, (unsigned long long)session->game.seed);
+}
+
+static void startSpectator(s_Server *server, int fd) {
+    if (server->spectatorCount == server->spectatorCapacity) {
+        int capacity = server->spectatorCapacity ? server->spectatorCapacity * 2 : 64;
+        s_Spectator **spectators = realloc(server->spectators, capacity * sizeof(*spectators));
+        if (!spectators) {
+            LOG_ERROR("Out of memory for a new spectator");
+            close(fd);
+            return;
+        }
+        server->spectators = spectators;
+        server->spectatorCapacity = capacity;
+    }
+    s_Spectator *spectator = poolAlloc(&server->spectatorPool);
+    if (!spectator) {
+        LOG_ERROR("Out of memory for a new spectator");
+        close(fd);
+        return;
+    }
+    memset(spectator, 0, sizeof(*spectator));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    spectator->kind = CONNECTION_SPECTATOR;
+    spectator->fd = fd;
+    server->spectators[server->spectatorCount++] = spectator;
+    if (!watchFd(server->loop, fd, spectator, false, false)) {
+        LOG_ERROR("Error watching a new spectator: %s", strerror(errno));
+        dropSpectator(server, spectator);
+    }
+}
+
+static void acceptConnections(s_Server *server, s_Listener *listener) {
+    for (;;) {
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd >= 0) {
+            if (listener->kind == CONNECTION_PLAYER_LISTENER) {
+                startSession(server, fd);
+            } else {
+                startSpectator(server, fd);
+            }
+        } else if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        } else if (errno == EMFILE || errno == ENFILE) {
+            // the listener would wake us up for this connection forever, so it sleeps until a connection is gone
+            LOG_ERROR("Out of file descriptors at %d sessions and %d spectators", server->count, server->spectatorCount);
+            unwatchFd(server->loop, listener->fd);
+            listener->accepting = false;
+            return;
+        } else {
+            return; // EAGAIN, nobody else is waiting
+        }
+    }
+}
+
+// puts the spectator on the broadcast of the game it asked for, the line is the number of the game (counted from
+// --seed like the seeds) or empty for the oldest game that is still running
+static bool attachSpectator(s_Server *server, s_Spectator *spectator) {
+    spectator->request[spectator->requestLength] = '\0';
+    char *end;
+    uint64_t number = strtoull(spectator->request, &end, 10);
+    bool oldest = spectator->requestLength == 0;
+    if (!oldest && *end != '\0') {
+        return false;
+    }
+    s_Session *found = NULL;
+    for (int i = 0; i < server->count; i++) {
+        s_Session *session = server->sessions[i];
+        uint64_t game = session->game.seed - server->options->seed;
+        if (session->closing || session->gone) {
+            continue;
+        }
+        if (oldest ? !found || game < found->game.seed - server->options->seed : game == number) {
+            found = session;
+        }
+    }
+    if (!found) {
+        LOG_DEBUG("Spectator %d asked for a game that is not running", spectator->fd);
+        return false;
+    }
+    s_Broadcast *broadcast = found->broadcast;
+    if (!broadcast) {
+        // the first spectator of this game, the log starts with a keyframe of how it looks now
+        broadcast = poolAlloc(&server->broadcastPool);
+        if (!broadcast) {
+            return false;
+        }
+        memset(broadcast, 0, sizeof(*broadcast));
+        if (!encodeKeyframe(&broadcast->log, &found->game)) {
+            freeBroadcast(server, broadcast);
+            return false;
+        }
+        memcpy(broadcast->status, broadcast->log.data + broadcast->log.length - BROADCAST_STATUS_SIZE,
+               BROADCAST_STATUS_SIZE);
+        broadcast->session = found;
+        found->broadcast = broadcast;
+    }
+    if (broadcast->count == broadcast->capacity) {
+        int capacity = broadcast->capacity ? broadcast->capacity * 2 : 4;
+        s_Spectator **spectators = realloc(broadcast->spectators, capacity * sizeof(*spectators));
+        if (!spectators) {
+            if (broadcast->count == 0) {
+                freeBroadcast(server, broadcast);
+            }
+            return false;
+        }
+        broadcast->spectators = spectators;
+        broadcast->capacity = capacity;
+    }
+    spectator->slot = broadcast->count;
+    broadcast->spectators[broadcast->count++] = spectator;
+    spectator->broadcast = broadcast;
+    spectator->offset = broadcast->keyframe;
+    LOG_DEBUG("Spectator %d watches session %d", spectator->fd, found->fd);
+    return sendSpectator(server, spectator);
+}
 
-            // now we need to move all lines that are above there once the line is cleared we need to move them below
-            for (int moveY = y; moveY > 0; moveY--) {
-                for (int x = 0; x < BOARD_WIDTH; x++) {
-                    board[moveY][x] = board[moveY - 1][x];
+// reads the request line of the spectator, anything it sends after that is ignored, false if it is gone
+static bool readSpectator(s_Server *server, s_Spectator *spectator) {
+    char input[256];
+    for (int reads = 0; reads < MAX_READS_PER_EVENT; reads++) {
+        ssize_t n = recv(spectator->fd, input, sizeof(input), 0);
+        if (n == 0) {
+            return false;
+        } else if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        for (ssize_t i = 0; i < n && !spectator->broadcast; i++) {
+            if (input[i] == '\n') {
+                if (!attachSpectator(server, spectator)) {
+                    return false;
+                }
+            } else if (input[i] != '\r') {
+                if (spectator->requestLength == sizeof(spectator->request) - 1) {
+                    return false;
                 }
+                spectator->request[spectator->requestLength++] = input[i];
             }
+        }
+    }
+    return true;
+}
 
-            // we need to clear the top line now
-            for (int x = 0; x < BOARD_WIDTH; x++) {
-                board[0][x] = EMPTY_CELL;
+// closes the spectators that are gone, a broadcast goes with its last spectator
+static void closeSpectators(s_Server *server) {
+    int kept = 0;
+    for (int i = 0; i < server->spectatorCount; i++) {
+        s_Spectator *spectator = server->spectators[i];
+        if (!spectator->gone) {
+            server->spectators[kept++] = spectator;
+            continue;
+        }
+        s_Broadcast *broadcast = spectator->broadcast;
+        if (broadcast) {
+            broadcast->spectators[spectator->slot] = broadcast->spectators[--broadcast->count];
+            broadcast->spectators[spectator->slot]->slot = spectator->slot;
+            if (broadcast->count == 0) {
+                freeBroadcast(server, broadcast);
             }
-            y++;
         }
+        LOG_DEBUG("Spectator %d closed", spectator->fd);
+        closeConnection(spectator->fd);
+        poolFree(&server->spectatorPool, spectator);
     }
+    server->spectatorCount = kept;
+    server->spectatorsGone = false;
+    resumeListeners(server);
+}
 
-    return linesCleared;
+// runs the keys through the telnet parser and the game, returns false if the connection is gone
+static bool readSession(s_Server *server, s_Session *session) {
+    uint8_t input[256];
+    for (int reads = 0; reads < MAX_READS_PER_EVENT; reads++) {
+        ssize_t n = recv(session->fd, input, sizeof(input), 0);
+        if (n == 0) {
+            return false;
+        } else if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            uint8_t byte = input[i];
+            char key;
+            switch (session->telnet) {
+                case TELNET_DATA:
+                    if (byte == TELNET_IAC) {
+                        session->telnet = TELNET_COMMAND;
+                    } else if (session->closing || !decodeKey(&session->input, byte, &key)) {
+                        break;
+                    } else if (key == 'q') {
+                        session->closing = true;
+                        session->redraw = true;
+                    } else {
+                        e_Action action = autoShiftKey(&session->shift, key, session->game.tick);
+                        if (server->options->recordFd >= 0) {
+                            recordAction(&session->replay, &session->game, action);
+                        }
+                        stepGame(&session->game, action);
+                        updateGameStats(&session->stats, &session->game);
+                        session->steps++;
+                        session->keyTime = session->keyTime ? session->keyTime : statsClock();
+                        session->closing = session->game.gameOver;
+                        session->redraw = true;
+                    }
+                    break;
+                case TELNET_COMMAND:
+                    if (byte == TELNET_WILL || byte == TELNET_WONT || byte == TELNET_DO || byte == TELNET_DONT) {
+                        session->telnet = TELNET_OPTION;
+                    } else if (byte == TELNET_SB) {
+                        session->telnet = TELNET_SUBNEGOTIATION;
+                    } else {
+                        session->telnet = TELNET_DATA; // a two byte command (or IAC IAC, a 255 we don't need either)
+                    }
+                    break;
+                case TELNET_OPTION:
+                    session->telnet = TELNET_DATA;
+                    break;
+                case TELNET_SUBNEGOTIATION:
+                    if (byte == TELNET_IAC) {
+                        session->telnet = TELNET_SUBNEGOTIATION_IAC;
+                    }
+                    break;
+                case TELNET_SUBNEGOTIATION_IAC:
+                    session->telnet = byte == TELNET_SE ? TELNET_DATA : TELNET_SUBNEGOTIATION;
+                    break;
+            }
+        }
+    }
+    return true;
 }
 
-// now we implement the conditional statement for the game itself and this is if the game will be over or not
-bool isGameOver() {
-    // if there are filled cells in the top row the game is over that is one condition, now let's write it
-    for (int x = 0; x < BOARD_WIDTH; x++) {
-        if (board[0][x] != EMPTY_CELL) {
-            return true;
-        } 
+// draws the session if it changed and nothing is waiting to go out anymore, returns false when it is done
+static bool updateSession(s_Server *server, s_Session *session) {
+    updateTimer(server, session);
+    // the spectators get every change right away, the player once the last frame is out
+    uint64_t dirtyRows = takeDirtyRows(&session->game.board);
+    session->dirtyRows |= dirtyRows;
+    if (session->broadcast) {
+        broadcastGame(server, session->broadcast, dirtyRows);
+    }
+    if (session->gone) {
+        return false;
+    }
+    if (session->renderer.length > 0) {
+        return true; // still busy with the last frame, the rest goes out when the socket is writable
+    }
+    if (session->redraw) {
+        displayGame(&session->renderer, &session->game, session->dirtyRows);
+        session->dirtyRows = 0;
+        session->redraw = false;
+        if (session->keyTime) {
+            recordTime(HISTOGRAM_INPUT, statsClock() - session->keyTime);
+            session->keyTime = 0;
+        }
+        if (session->closing) {
+            char goodbye[64];
+            int length = snprintf(goodbye, sizeof(goodbye), "\033[?25h\r\nGame Over! Final Score: %d\r\n",
+                                  session->game.score);
+            appendOutput(&session->renderer, goodbye, length);
+        }
+    }
+    if (!sendSession(server, session)) {
+        return false;
     }
+    return !(session->closing && session->renderer.length == 0); // everything is out, so we can hang up
+}
 
-    return false;
+static int openListener(int port) {
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR("Error creating the server socket: %s", strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    int off = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 clients come in on the same socket
+    struct sockaddr_in6 address;
+    memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        LOG_ERROR("Error listening on port %d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
 }
 
-// now we are left wiht the main function of the game and we are done
+static volatile sig_atomic_t stopServer = 0;
+
+static void onStopSignal(int signal) {
+    (void)signal;
+    stopServer = 1;
+}
+
+int runServer(const s_Options *options) {
+    signal(SIGPIPE, SIG_IGN); // a player that is gone is an error from send, not a reason to stop
+    // ctrl-c ends all the games properly, so the recorded ones make it into the file
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = onStopSignal;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    s_Server server;
+    memset(&server, 0, sizeof(server));
+    server.options = options;
+    initPool(&server.sessionPool, sizeof(s_Session), POOL_SLAB_OBJECTS);
+    initPool(&server.spectatorPool, sizeof(s_Spectator), POOL_SLAB_OBJECTS);
+    initPool(&server.broadcastPool, sizeof(s_Broadcast), POOL_SLAB_OBJECTS);
+    server.results.fd = -1;
+    server.playerListener = (s_Listener){ .kind = CONNECTION_PLAYER_LISTENER, .fd = openListener(options->port) };
+    server.spectatorListener = (s_Listener){ .kind = CONNECTION_SPECTATOR_LISTENER, .fd = -1 };
+    if (server.playerListener.fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (options->spectatePort > 0) {
+        server.spectatorListener.fd = openListener(options->spectatePort);
+        if (server.spectatorListener.fd < 0) {
+            close(server.playerListener.fd);
+            return EXIT_FAILURE;
+        }
+    }
+    server.loop = createEventLoop();
+    if (server.loop < 0) {
+        LOG_ERROR("Error creating the event loop: %s", strerror(errno));
+        close(server.playerListener.fd);
+        if (server.spectatorListener.fd >= 0) {
+            close(server.spectatorListener.fd);
+        }
+        return EXIT_FAILURE;
+    }
+    resumeListeners(&server);
+    if (!server.playerListener.accepting || (server.spectatorListener.fd >= 0 && !server.spectatorListener.accepting)) {
+        LOG_ERROR("Error watching the server sockets: %s", strerror(errno));
+        stopServer = 1;
+    }
+    if (options->resultsFd >= 0 && !initResultWriter(&server.results, options->resultsFd)) {
+        LOG_ERROR("Error allocating the results buffer");
+        server.results.fd = -1;
+        stopServer = 1;
+    }
+    initScheduler(&server.scheduler, monotonicMicros());
+    printf("listening on port %d\n", options->port);
+    if (options->spectatePort > 0) {
+        printf("spectators on port %d\n", options->spectatePort);
+    }
+    fflush(stdout);
+
+    static s_Event events[MAX_EVENTS];
+    int status = 0;
+    while (!stopServer) {
+        int timeout = -1;
+        if (server.timerCount > 0) {
+            timeout = (int)((microsUntilTick(&server.scheduler, sessionDueTick(server.timers[0])) + 999) / 1000);
+        }
+        if (server.results.count > 0) {
+            int flushTimeout = (int)((microsUntilTick(&server.scheduler, server.resultsFlushTick) + 999) / 1000);
+            timeout = timeout < 0 || flushTimeout < timeout ? flushTimeout : timeout;
+        }
+        int count = waitEvents(server.loop, events, timeout);
+        if (count < 0) {
+            if (errno != EINTR) {
+                LOG_ERROR("Error waiting for events: %s", strerror(errno));
+                status = EXIT_FAILURE;
+                break;
+            }
+            count = 0;
+        }
+        advanceScheduler(&server.scheduler, monotonicMicros());
+
+        for (int i = 0; i < count; i++) {
+            uint8_t kind = *(const uint8_t *)events[i].data;
+            if (kind == CONNECTION_PLAYER_LISTENER || kind == CONNECTION_SPECTATOR_LISTENER) {
+                acceptConnections(&server, events[i].data);
+                continue;
+            }
+            if (kind == CONNECTION_SPECTATOR) {
+                s_Spectator *spectator = events[i].data;
+                if (!spectator->gone && events[i].readable && !readSpectator(&server, spectator)) {
+                    dropSpectator(&server, spectator);
+                }
+                if (!spectator->gone && events[i].writable && spectator->broadcast &&
+                    !sendSpectator(&server, spectator)) {
+                    dropSpectator(&server, spectator);
+                }
+                continue;
+            }
+            s_Session *session = events[i].data;
+            if (session->gone) {
+                continue;
+            }
+            if (events[i].readable) {
+                // the game first has to get to the tick the keys came in at
+                catchUpSession(&server, session);
+                session->gone = !readSession(&server, session);
+            }
+            if (events[i].writable && !session->gone) {
+                session->gone = !sendSession(&server, session);
+            }
+            touchSession(&server, session);
+        }
+
+        // the drops that are due now
+        while (server.timerCount > 0 && sessionDueTick(server.timers[0]) <= server.scheduler.tick) {
+            s_Session *session = server.timers[0];
+            catchUpSession(&server, session);
+            updateTimer(&server, session);
+            touchSession(&server, session);
+        }
+
+        // and everything that happened goes out
+        for (int i = 0; i < server.touchedCount; i++) {
+            s_Session *session = server.touched[i];
+            session->touched = false;
+            if (!updateSession(&server, session)) {
+                closeSession(&server, session);
+            }
+        }
+        server.touchedCount = 0;
+        if (server.spectatorsGone) {
+            closeSpectators(&server);
+        }
+        // so a server that is killed or crashes only loses the last second of games
+        if (server.results.count > 0 && server.resultsFlushTick <= server.scheduler.tick) {
+            flushResults(&server.results);
+        }
+    }
+    while (server.count > 0) {
+        closeSession(&server, server.sessions[server.count - 1]);
+    }
+    for (int i = 0; i < server.spectatorCount; i++) {
+        server.spectators[i]->gone = true;
+    }
+    closeSpectators(&server);
+    free(server.sessions);
+    free(server.timers);
+    free(server.touched);
+    free(server.spectators);
+    freePool(&server.sessionPool);
+    freePool(&server.spectatorPool);
+    freePool(&server.broadcastPool);
+    if (server.results.fd >= 0) {
+        closeResultWriter(&server.results);
+    }
+    close(server.loop);
+    close(server.playerListener.fd);
+    if (server.spectatorListener.fd >= 0) {
+        close(server.spectatorListener.fd);
+    }
+    return status;
+}
+
+// watches a game on a server that was started with --spectate, the frames go into a game of our own and are drawn
+// with the same renderer as when we play, so it looks just like it does for the player
+int watchGame(const s_Options *options) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addresses;
+    char port[16];
+    snprintf(port, sizeof(port), "%d", options->port);
+    int error = getaddrinfo(options->watchHost, port, &hints, &addresses);
+    if (error != 0) {
+        fprintf(stderr, "Could not find %s: %s\n", options->watchHost, gai_strerror(error));
+        return EXIT_FAILURE;
+    }
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to %s port %d: %s\n", options->watchHost, options->port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // which game we want, an empty line is the oldest one
+    char request[32];
+    int length = options->watchGame >= 0 ? snprintf(request, sizeof(request), "%d\n", options->watchGame)
+                                         : snprintf(request, sizeof(request), "\n");
+    if (send(fd, request, length, 0) != length) {
+        fprintf(stderr, "Could not send to %s: %s\n", options->watchHost, strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
 
-int main(void) {
+    setupTerminal();
+    static s_Renderer renderer;
+    initRenderer(&renderer, STDOUT_FILENO);
+    static s_GameState game;
+    memset(&game, 0, sizeof(game));
+    static uint8_t input[1 << 16]; // more than the biggest frame, so there always is room for the rest of one
+    size_t buffered = 0;
+    s_InputRing keyRing = { 0 };
+    bool keys = true; // false once stdin is gone, then we just watch until the game ends
+    bool started = false;
+    bool ended = false;
+    bool broken = false;
+    bool quit = false;
+    while (!ended && !broken && !quit) {
+        struct pollfd fds[2] = { { .fd = fd, .events = POLLIN }, { .fd = keys ? STDIN_FILENO : -1, .events = POLLIN } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            keys = readKeys(&keyRing, STDIN_FILENO) != -1;
+            char key;
+            while (!quit && nextKey(&keyRing, &key)) {
+                quit = key == 'q';
+            }
+        }
+        if (!fds[0].revents) {
+            continue;
+        }
+        ssize_t n = recv(fd, input + buffered, sizeof(input) - buffered, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            break; // the server is gone
+        }
+        buffered += n;
+        // all the complete frames, the game is drawn once for all of them
+        size_t used = 0;
+        bool changed = false;
+        while (!ended && !broken) {
+            int size = decodeFrame(input + used, buffered - used, &game, &ended);
+            if (size < 0) {
+                broken = true;
+            } else if (size == 0) {
+                break;
+            } else {
+                used += size;
+                changed = true;
+            }
+        }
+        memmove(input, input + used, buffered - used);
+        buffered -= used;
+        if (changed && !broken) {
+            displayGame(&renderer, &game, takeDirtyRows(&game.board));
+            started = true;
+        }
+    }
+    closeRenderer(&renderer);
+    if (ended) {
+        printf("Game Over! Final Score: %d\n", game.score);
+    } else if (broken) {
+        printf("The server sent something that is not a game of this build (the board size has to be the same)\n");
+    } else if (!quit) {
+        printf(started ? "The server closed the connection\n" : "There is no such game to watch\n");
+    }
+    resetTerminal();
+    close(fd);
+    return broken ? EXIT_FAILURE : 0;
+}
+
+// the normal game in the terminal
+int playInteractive(const s_Options *options) {
+    // we initialize the board, the first piece and the score board, or take them from the save
+    s_GameState game;
+    if (options->load) {
+        if (!loadGame(&game, options->load)) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        initGame(&game, options->seed, options->randomizer);
+    }
 
-    // first let's initialize the random seed
-    srand(time(NULL));
     // we setup the terminal
     setupTerminal();
-    // we initialize the board
-    initBoard();
 
-    s_Tetromino piece;
-    createTetronino(&piece); // now we make that piece 
+    // the renderer remembers the last frame, it is a bit big for the stack so it is static
+    static s_Renderer renderer;
+    initRenderer(&renderer, STDOUT_FILENO);
 
-    // we initializet the score board:
-    int score = 0;
-    int level = 1;
-    int linesCleared = 0;
-    int dropSpeed = 500000; // this is in microseconds so this is 0.5 seconds
-    bool gameOver = false;
+    s_ReplayWriter replay = { 0 };
+    if (options->recordFd >= 0) {
+        beginReplay(&replay, &game);
+    }
 
-    // we set the timer for pieces to drop
-    clock_t lastDrop = clock();
+    // we set the timer for pieces to drop, the drop happens every dropSpeed worth of ticks
+    s_TickScheduler scheduler;
+    initScheduler(&scheduler, monotonicMicros());
+    scheduler.tick = game.tick; // a loaded game goes on from its own time
+    s_InputRing keys = { 0 };
+    s_AutoShift shift;
+    initAutoShift(&shift, options->das, options->arr);
+    bool redraw = true;
+    bool quit = false;
+    uint64_t keyTime = 0; // when the first key the next frame shows was read, 0 if there is none
     // now we loop the game itself
-    while(!gameOver) {
-        displayGame(&piece);
-
-        // we print the game info:
-        printf("Score: %d Level: %d Lines: %d\n", score, level, linesCleared);
-        printf("Controls: A/D - Move; W - Rotate; S - Drop; Q - Quit\n");
-        // now we read the key input we handle the inputs
-        if (keybit() == 1) {
-            char key = getch();
-             printf("Key pressed: %c\n", key);
-            
-            // Add this line to see debug output before it's cleared
-            // sleep(1); // Wait 1 second after key press
-            switch(key) {
-                case 'a': 
-                    moveTetrominoLeft(&piece); // moving the tetromino left
-                    break;
-                case 'd':
-                    moveTetrominoRight(&piece); // moving the tetromino right
-                    break;
-                case 'w':
-                    rotateTetromino(&piece); // rotating the tetromino
-                    break;
-                case 's':
-                    // this is for moving down
-                    if (!moveTetrominoDown(&piece)) {
-                        placeTetromino(&piece);
-                        int lines = clearLines();
-                        if (lines > 0) {
-                            linesCleared += lines;
-                            score += lines * 100 * level; // this is the algorithm I am going for for loading the score
-
-                            // we need to level up every 10 lines we reach a new level
-                            level = (linesCleared / 10) + 1; // so this is important because if we go from anything below 10 lines level stays the same
-                            dropSpeed = 500000 / level; // we increase the speed everytime as we reach level
-                        }
-                        createTetronino(&piece); // we make a new piece now
-                        if (!is_in_valid_position(&piece)) {
-                            gameOver = true; 
-                        }
-                    }
-                lastDrop = clock(); // we need to reset the time                   
-                break;
-            case 'q':
-                gameOver = true;
-                break;
+    while(!game.gameOver && !quit) {
+        // we only draw when something actually changed, a key or a drop
+        if (redraw) {
+            displayGame(&renderer, &game, takeDirtyRows(&game.board));
+            redraw = false;
+            if (keyTime) {
+                recordTime(HISTOGRAM_INPUT, statsClock() - keyTime);
+                keyTime = 0;
             }
         }
 
-        // we also need to autodrop the piece as well
-        clock_t currentTime = clock();
-        if ((currentTime - lastDrop) * 1000000 / CLOCKS_PER_SEC > dropSpeed) {
-            if (!moveTetrominoDown(&piece)) {
-                placeTetromino(&piece);
-                int lines = clearLines();
-                if (lines > 0) {
-                    linesCleared += lines;
-                    score += lines * 100 * level;
+        // now we wait for a key but not longer than until the piece has to drop (or move, if a key is held)
+        uint64_t due = nextDropTick(&game) < autoShiftDueTick(&shift) ? nextDropTick(&game) : autoShiftDueTick(&shift);
+        int timeout = (int)((microsUntilTick(&scheduler, due) + 999) / 1000);
+        struct pollfd input = { .fd = STDIN_FILENO, .events = POLLIN };
+        int ready = poll(&input, 1, timeout);
 
-                    // level up every 10 lines
-                    level = (linesCleared / 10) + 1;
-                    dropSpeed = 500000 / level;
-                }
-                createTetronino(&piece);
-                if (!is_in_valid_position(&piece)) {
-                    gameOver = true;
+        // we also need to autodrop the piece as well, and move it for a held key
+        uint64_t before = nextDropTick(&game);
+        int x = game.piece.x;
+        uint64_t ticks = advanceScheduler(&scheduler, monotonicMicros());
+        advanceAutoShift(&shift, &game, game.tick + ticks, options->recordFd >= 0 ? &replay : NULL);
+        if (nextDropTick(&game) != before || game.piece.x != x) {
+            redraw = true;
+        }
+
+        // now we read the key input, all of it, and we handle the inputs before the next frame
+        if (ready > 0 && readKeys(&keys, STDIN_FILENO) == -1) {
+            quit = true; // nobody is there to play anymore
+        }
+        char key;
+        while (!quit && !game.gameOver && nextKey(&keys, &key)) {
+            LOG_DEBUG("Key pressed: %c", key);
+            if (key == 'q') {
+                quit = true;
+            } else {
+                e_Action action = autoShiftKey(&shift, key, game.tick);
+                if (options->recordFd >= 0) {
+                    recordAction(&replay, &game, action);
                 }
+                stepGame(&game, action);
+                redraw = true;
+                keyTime = keyTime ? keyTime : statsClock();
             }
-            lastDrop = currentTime;
         }
-        // some delay to help the CPU!
-        usleep(16000);
     }
     // game over here
-    displayGame(&piece);
-    printf("Game Over! Final Score: %d\n", score);
+    displayGame(&renderer, &game, takeDirtyRows(&game.board));
+    closeRenderer(&renderer);
+    printf("Game Over! Final Score: %d\n", game.score);
+    printf("Seed: %llu\n", (unsigned long long)game.seed); // with --seed this exact game can be played again
 
     // we reset the terminal back
     resetTerminal();
 
+    if (options->recordFd >= 0) {
+        endReplay(&replay, &game, options->recordFd);
+        freeReplay(&replay);
+    }
+    // quitting in the middle of a game keeps it for --load
+    if (options->save && !game.gameOver) {
+        if (!saveGame(&game, options->save)) {
+            return EXIT_FAILURE;
+        }
+        printf("Saved to %s\n", options->save);
+    }
+
     return 0;
 }
+
+/*
+ * The environment for training against the game, a batch of games that are stepped together with one call so a
+ * binding (Python through ctypes and NumPy) pays the call once for thousands of games and not once per game.
+ * The games are one block of s_GameState next to each other (the struct is plain data, so the block is the whole
+ * state of the batch and can be copied as it is). Splitting the rows and heights out into arrays of their own does
+ * not buy anything here: a step is one game at a time from the action to the observation, and it reads and writes
+ * the rows, the heights and the piece together, so that would mean three places in memory per game instead of the
+ * two or three cache lines of one struct (128 bytes on a 10 wide board). A step also costs about the same whether
+ * the batch fits in the cache or not, measured with random actions and one tick of gravity: about 80 ns per game
+ * step with 256 games (32 KB), 84 with 8192 (1 MB) and 89 with 262144 (32 MB). So the time goes into the game and
+ * not into memory, and there is nothing a different layout could win. The observations are written straight into a buffer of the caller
+ * that is laid out as arrays, game after game with the same parts at the same offsets, so NumPy can look at it with
+ * a view and nothing has to be copied on that side. describeEnv tells the binding the layout of this build.
+ * A step is one action for every game and then ticksPerStep ticks of gravity (0 means the pieces only fall when they
+ * are dropped), a game that ends is done for that step and starts again with the next seed right away, so its
+ * observation is already one of the new game.
+ * Build it as a shared library with -DTETRIS_LIBRARY -fPIC -shared -fvisibility=hidden, the functions below are the
+ * only ones it exports.
+ */
+#ifdef TETRIS_LIBRARY
+#define TETRIS_API __attribute__((visibility("default")))
+#else
+#define TETRIS_API
+#endif
+
+#define OBSERVATION_ROW_BYTES BROADCAST_ROW_BYTES // the rows little endian, bit x of a row is column x
+#define OBSERVATION_ROWS_OFFSET 0
+#define OBSERVATION_PIECE_OFFSET (OBSERVATION_ROWS_OFFSET + BOARD_HEIGHT * OBSERVATION_ROW_BYTES) // type, rotation, x, y
+#define OBSERVATION_NEXT_OFFSET (OBSERVATION_PIECE_OFFSET + 4)
+#define OBSERVATION_HEIGHTS_OFFSET (OBSERVATION_NEXT_OFFSET + NEXT_PIECES)
+#define OBSERVATION_SIZE (OBSERVATION_HEIGHTS_OFFSET + BOARD_WIDTH)
+
+// what a binding needs to know about this build, all the sizes are in bytes
+typedef struct {
+    int32_t boardWidth;
+    int32_t boardHeight;
+    int32_t nextPieces;
+    int32_t actions; // the actions are the e_Action values below this
+    int32_t observationSize; // of one game, the one of game i starts at i * observationSize
+    int32_t rowsOffset; // boardHeight rows of rowBytes, the top row first, without the falling piece
+    int32_t rowBytes;
+    int32_t pieceOffset; // the falling piece, its type, rotation, x and y (x as a signed byte)
+    int32_t nextOffset;
+    int32_t heightsOffset;
+} s_EnvInfo;
+
+typedef struct {
+    int count;
+    int ticksPerStep;
+    e_Randomizer randomizer;
+    uint64_t nextSeed; // for the next game that starts, game i of the first reset gets seed + i
+    _Alignas(64) s_GameState games[];
+} s_EnvBatch;
+
+TETRIS_API void describeEnv(s_EnvInfo *info) {
+    info->boardWidth = BOARD_WIDTH;
+    info->boardHeight = BOARD_HEIGHT;
+    info->nextPieces = NEXT_PIECES;
+    info->actions = NUM_OF_ACTIONS;
+    info->observationSize = OBSERVATION_SIZE;
+    info->rowsOffset = OBSERVATION_ROWS_OFFSET;
+    info->rowBytes = OBSERVATION_ROW_BYTES;
+    info->pieceOffset = OBSERVATION_PIECE_OFFSET;
+    info->nextOffset = OBSERVATION_NEXT_OFFSET;
+    info->heightsOffset = OBSERVATION_HEIGHTS_OFFSET;
+}
+
+// bag is 0 for the uniform randomizer and 1 for the 7 bag, NULL if there is not enough memory
+TETRIS_API s_EnvBatch *createEnvBatch(int count, uint64_t seed, int ticksPerStep, int bag) {
+#ifndef NDEBUG
+    checkTetrominoInfo();
+#endif
+    if (count < 1 || ticksPerStep < 0) {
+        return NULL;
+    }
+    size_t size = sizeof(s_EnvBatch) + (size_t)count * sizeof(s_GameState);
+    s_EnvBatch *batch = aligned_alloc(64, (size + 63) & ~(size_t)63);
+    if (!batch) {
+        return NULL;
+    }
+    batch->count = count;
+    batch->ticksPerStep = ticksPerStep;
+    batch->randomizer = bag ? RANDOMIZER_BAG : RANDOMIZER_UNIFORM;
+    batch->nextSeed = seed;
+    for (int i = 0; i < count; i++) {
+        initGame(&batch->games[i], batch->nextSeed++, batch->randomizer);
+    }
+    return batch;
+}
+
+TETRIS_API void destroyEnvBatch(s_EnvBatch *batch) {
+    free(batch);
+}
+
+static void writeObservation(const s_GameState *game, uint8_t *out) {
+    uint8_t *rows = out + OBSERVATION_ROWS_OFFSET;
+    for (int y = 0; y < BOARD_HEIGHT; y++) {
+        putLittle(rows + y * OBSERVATION_ROW_BYTES, game->board.rows[y], OBSERVATION_ROW_BYTES);
+    }
+    uint8_t *piece = out + OBSERVATION_PIECE_OFFSET;
+    piece[0] = game->piece.type;
+    piece[1] = game->piece.rotation;
+    piece[2] = (uint8_t)game->piece.x;
+    piece[3] = (uint8_t)game->piece.y;
+    memcpy(out + OBSERVATION_NEXT_OFFSET, game->next, NEXT_PIECES);
+    memcpy(out + OBSERVATION_HEIGHTS_OFFSET, game->board.heights, BOARD_WIDTH);
+}
+
+// starts all the games again with new seeds, observations is count * observationSize bytes (or NULL)
+TETRIS_API void resetBatch(s_EnvBatch *batch, uint8_t *observations) {
+    for (int i = 0; i < batch->count; i++) {
+        initGame(&batch->games[i], batch->nextSeed++, batch->randomizer);
+        if (observations) {
+            writeObservation(&batch->games[i], observations + (size_t)i * OBSERVATION_SIZE);
+        }
+    }
+}
+
+// actions has one e_Action per game (anything else does nothing), rewards gets the score each game made in the step
+// and dones 1 for the games that ended in it, every output can be NULL when it is not wanted
+TETRIS_API void stepBatch(s_EnvBatch *batch, const uint8_t *actions, uint8_t *observations, int32_t *rewards,
+                          uint8_t *dones) {
+    for (int i = 0; i < batch->count; i++) {
+        s_GameState *game = &batch->games[i];
+        int score = game->score;
+        stepGame(game, actions[i] < NUM_OF_ACTIONS ? (e_Action)actions[i] : ACTION_NONE);
+        advanceGame(game, batch->ticksPerStep);
+        if (rewards) {
+            rewards[i] = game->score - score;
+        }
+        if (dones) {
+            dones[i] = game->gameOver;
+        }
+        if (game->gameOver) {
+            initGame(game, batch->nextSeed++, batch->randomizer);
+        }
+        if (observations) {
+            writeObservation(game, observations + (size_t)i * OBSERVATION_SIZE);
+        }
+    }
+}
+
+#ifndef TETRIS_LIBRARY
+static void printUsage(const char *program) {
+    fprintf(stderr, "usage: %s [--log FILE] [--stats] [--seed N] [--bag] [--das MS] [--arr MS] [--record FILE] [--save FILE] [--load FILE]\n"
+                    "           [--headless [--games N] [--threads N] [--max-steps N] [--results FILE]\n"
+                    "           [--script KEYS | --bot [--depth N] [--search-threads N]]]\n", program);
+    fprintf(stderr, "       %s [--seed N] [--bag] [--das MS] [--arr MS] [--record FILE] [--results FILE]\n"
+                    "           --server PORT [--spectate PORT]\n", program);
+    fprintf(stderr, "       %s --watch HOST PORT [--game N]\n", program);
+    fprintf(stderr, "       %s --bench\n", program);
+    fprintf(stderr, "       %s --replay FILE [--threads N]\n", program);
+    fprintf(stderr, "       %s --index REPLAYS CORPUS\n", program);
+    fprintf(stderr, "       %s --merge OUTPUT RESULTS...\n", program);
+}
+
+// now we are left wiht the main function of the game and we are done
+
+int main(int argc, char **argv) {
+
+#ifndef NDEBUG
+    checkTetrominoInfo();
+#endif
+    // first let's pick the random seed, in headless mode every game gets the next one after it
+    s_Options options = {
+        .mode = MODE_INTERACTIVE,
+        .games = 1,
+        .threads = (int)sysconf(_SC_NPROCESSORS_ONLN), // one thread per core unless we are told otherwise
+        .script = NULL,
+        .seed = (uint64_t)time(NULL),
+        .randomizer = RANDOMIZER_UNIFORM,
+        .maxSteps = HEADLESS_MAX_STEPS,
+        .bot = false,
+        .searchDepth = 2,
+        .searchThreads = 1,
+        .recordFd = -1,
+        .resultsFd = -1,
+        .mergeOutput = NULL,
+        .mergeInputs = NULL,
+        .mergeCount = 0,
+        .replay = NULL,
+        .indexOutput = NULL,
+        .save = NULL,
+        .load = NULL,
+        .port = 0,
+        .spectatePort = 0,
+        .watchHost = NULL,
+        .watchGame = -1,
+        .das = DEFAULT_DAS,
+        .arr = DEFAULT_ARR,
+        .stats = false
+    };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.mode = MODE_HEADLESS;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            options.mode = MODE_BENCH;
+        } else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+            options.games = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            options.script = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--bag") == 0) {
+            options.randomizer = RANDOMIZER_BAG;
+        } else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+            options.maxSteps = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--bot") == 0) {
+            options.bot = true;
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            options.searchDepth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--search-threads") == 0 && i + 1 < argc) {
+            options.searchThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            options.recordFd = open(argv[++i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (options.recordFd < 0) {
+                fprintf(stderr, "Could not open the replay file %s: %s\n", argv[i], strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc) {
+            options.resultsFd = createResults(argv[++i]);
+            if (options.resultsFd < 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 2 < argc) {
+            // everything after the output is an input
+            options.mode = MODE_MERGE;
+            options.mergeOutput = argv[i + 1];
+            options.mergeInputs = argv + i + 2;
+            options.mergeCount = argc - i - 2;
+            i = argc;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            options.mode = MODE_REPLAY;
+            options.replay = argv[++i];
+        } else if (strcmp(argv[i], "--index") == 0 && i + 2 < argc) {
+            options.mode = MODE_INDEX;
+            options.replay = argv[++i];
+            options.indexOutput = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            options.mode = MODE_SERVER;
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spectate") == 0 && i + 1 < argc) {
+            options.spectatePort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 2 < argc) {
+            options.mode = MODE_WATCH;
+            options.watchHost = argv[++i];
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--game") == 0 && i + 1 < argc) {
+            options.watchGame = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--das") == 0 && i + 1 < argc) {
+            options.das = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--arr") == 0 && i + 1 < argc) {
+            options.arr = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            options.save = argv[++i];
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            options.load = argv[++i];
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logFd = open(argv[++i], O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (logFd < 0) {
+                fprintf(stderr, "Could not open the log file %s: %s\n", argv[i], strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the bot puts its pieces straight where they go, there are no keys to record
+    if (options.recordFd >= 0 && options.bot) {
+        fprintf(stderr, "--record only works for games played with keys, not with --bot\n");
+        return EXIT_FAILURE;
+    }
+    // a replay starts from the seed, a loaded game is already somewhere else
+    if (options.recordFd >= 0 && options.load) {
+        fprintf(stderr, "--record can not be used with --load\n");
+        return EXIT_FAILURE;
+    }
+    // a held key can repeat right away at the soonest, there is nothing below 0
+    if (options.das < 0 || options.arr < 0) {
+        fprintf(stderr, "--das and --arr are milliseconds, 0 or more\n");
+        return EXIT_FAILURE;
+    }
+
+    // without --log the messages can go to stderr, unless that is the same terminal the game is drawn on
+    if (logFd < 0 && !isatty(STDERR_FILENO)) {
+        logFd = STDERR_FILENO;
+    }
+
+    // SIGUSR1 is only ever taken by the stats thread, the threads started after this inherit the blocked signal
+    static sigset_t statsSignals;
+    sigemptyset(&statsSignals);
+    sigaddset(&statsSignals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &statsSignals, NULL);
+    pthread_t statsThread;
+    if (pthread_create(&statsThread, NULL, statsSignalThread, &statsSignals) == 0) {
+        pthread_detach(statsThread);
+    }
+
+    int status;
+    switch (options.mode) {
+        case MODE_HEADLESS:
+            status = playHeadless(&options);
+            break;
+        case MODE_BENCH:
+            status = runBenchmarks();
+            break;
+        case MODE_REPLAY:
+            status = playReplays(&options);
+            break;
+        case MODE_INDEX:
+            status = indexReplays(options.replay, options.indexOutput);
+            break;
+        case MODE_SERVER:
+            status = runServer(&options);
+            break;
+        case MODE_WATCH:
+            status = watchGame(&options);
+            break;
+        case MODE_MERGE:
+            status = mergeResults(options.mergeOutput, options.mergeInputs, options.mergeCount);
+            break;
+        default:
+            status = playInteractive(&options);
+            break;
+    }
+    if (options.stats) {
+        dumpStats(logFd >= 0 ? logFd : STDERR_FILENO);
+    }
+    return status;
+}
+#endif